@@ -1,6 +1,11 @@
 #ifndef AABB_H
 #define AABB_H
 
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+
 class AABB {
 private:
 	float min_x_;
@@ -11,18 +16,81 @@ private:
 	float max_z_;
 
 public:
-	AABB() : min_x_(0), max_x_(0), min_y_(0), max_y_(0)
+	AABB() : min_x_(0), max_x_(0), min_y_(0), max_y_(0), min_z_(0), max_z_(0)
 	{ }
 	AABB(float minX, float maxX, float minY, float maxY, float minZ, float maxZ)
 		: min_x_(minX), max_x_(maxX), min_y_(minY), max_y_(maxY), min_z_(minZ), max_z_(maxZ)
 	{ }
-	bool isOverlap(const AABB& another) const
+	AABB(const glm::vec3 &minCorner, const glm::vec3 &maxCorner)
+		: min_x_(minCorner.x), max_x_(maxCorner.x), min_y_(minCorner.y), max_y_(maxCorner.y), min_z_(minCorner.z), max_z_(maxCorner.z)
+	{ }
+
+	// an inverted box that any expand() call turns into a valid one
+	static AABB empty()
 	{
+		return AABB(FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX);
+	}
 
+	bool isEmpty() const
+	{
+		return min_x_ > max_x_ || min_y_ > max_y_ || min_z_ > max_z_;
 	}
-	bool isContain(const AABB& another) const
+
+	glm::vec3 getMin() const
+	{
+		return glm::vec3(min_x_, min_y_, min_z_);
+	}
+	glm::vec3 getMax() const
+	{
+		return glm::vec3(max_x_, max_y_, max_z_);
+	}
+	glm::vec3 getCenter() const
+	{
+		return glm::vec3(min_x_ + max_x_, min_y_ + max_y_, min_z_ + max_z_) * 0.5f;
+	}
+	glm::vec3 getExtent() const
 	{
+		return glm::vec3(max_x_ - min_x_, max_y_ - min_y_, max_z_ - min_z_) * 0.5f;
+	}
+
+	void expand(const glm::vec3 &p)
+	{
+		min_x_ = std::min(min_x_, p.x); max_x_ = std::max(max_x_, p.x);
+		min_y_ = std::min(min_y_, p.y); max_y_ = std::max(max_y_, p.y);
+		min_z_ = std::min(min_z_, p.z); max_z_ = std::max(max_z_, p.z);
+	}
+	void expand(const AABB &another)
+	{
+		if (another.isEmpty())
+			return;
+		expand(another.getMin());
+		expand(another.getMax());
+	}
+
+	// box enclosing this box after transformation by m
+	AABB transformed(const glm::mat4 &m) const
+	{
+		if (isEmpty())
+			return *this;
+		glm::vec3 center = glm::vec3(m * glm::vec4(getCenter(), 1.0f));
+		glm::vec3 extent = getExtent();
+		glm::vec3 newExtent;
+		for (int i = 0; i < 3; i++)
+			newExtent[i] = std::abs(m[0][i]) * extent.x + std::abs(m[1][i]) * extent.y + std::abs(m[2][i]) * extent.z;
+		return AABB(center - newExtent, center + newExtent);
+	}
 
+	bool isOverlap(const AABB& another) const
+	{
+		return min_x_ <= another.max_x_ && max_x_ >= another.min_x_
+			&& min_y_ <= another.max_y_ && max_y_ >= another.min_y_
+			&& min_z_ <= another.max_z_ && max_z_ >= another.min_z_;
+	}
+	bool isContain(const AABB& another) const
+	{
+		return min_x_ <= another.min_x_ && max_x_ >= another.max_x_
+			&& min_y_ <= another.min_y_ && max_y_ >= another.max_y_
+			&& min_z_ <= another.min_z_ && max_z_ >= another.max_z_;
 	}
 };
 
@@ -0,0 +1,361 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+// Command-line benchmarks of the engine services. They run before any window or GL
+// context exists, so only CPU-side work is measured.
+
+#include "ClusteredLights.h"
+#include "EntityStore.h"
+#include "ImportArena.h"
+#include "JobSystem.h"
+#include "Model.h"
+#include "OcclusionCuller.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+// Counts the heap allocations of the calling thread while it lives, for --bench-import. Only in builds
+// with BENCHMARK_COUNT_ALLOCATIONS, where main.cpp replaces operator new with one that calls counted();
+// without a count alive on the thread that's a thread-local load and a test.
+class AllocationCount {
+public:
+	AllocationCount() : count(0), outer(current)
+	{
+		current = this;
+	}
+	~AllocationCount()
+	{
+		current = outer;
+	}
+	AllocationCount(const AllocationCount&) = delete;
+	AllocationCount &operator=(const AllocationCount&) = delete;
+
+	size_t get() const
+	{
+		return count;
+	}
+
+	static void counted()
+	{
+		if (current)
+			current->count++;
+	}
+
+private:
+	size_t count;
+	AllocationCount *outer; // counts nest; only the innermost counts
+	static thread_local AllocationCount *current; // defined in main.cpp
+};
+#endif
+
+inline double BenchmarkMilliseconds(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// runs body `repeats` times and returns the best time in milliseconds
+template <typename F>
+double BenchmarkBestOf(int repeats, F body)
+{
+	double best = 1e30;
+	for (int r = 0; r < repeats; r++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		body();
+		double elapsed = BenchmarkMilliseconds(start);
+		if (elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+// --bench-jobs: job system scaling at 1..N threads on synthetic work, texture decoding and mesh processing
+inline int RunJobSystemBenchmark(const std::string &modelPath)
+{
+	// real workloads come from the model; import once, outside the measurements
+	Assimp::Importer importer;
+	const aiScene *scene = importer.ReadFile(modelPath, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+	std::vector<const aiMesh*> sceneMeshes;
+	std::vector<std::string> texturePaths, typeNames;
+	std::string directory = modelPath.substr(0, modelPath.find_last_of('/'));
+	if (scene && scene->mRootNode && !(scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE))
+	{
+		Model::CollectMeshes(scene->mRootNode, scene, sceneMeshes);
+		Model::CollectTexturePaths(sceneMeshes, scene, texturePaths, typeNames);
+	}
+	else
+		std::cout << "Benchmark: " << modelPath << " not available, running synthetic workloads only" << std::endl;
+
+	unsigned int maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+
+	std::cout << "threads | tiny jobs (ms) | parallel for (ms) | texture decode (ms) | mesh processing (ms)" << std::endl;
+	double base[4] = { 0.0, 0.0, 0.0, 0.0 };
+	for (unsigned int threads = 1; threads <= maxThreads; threads++)
+	{
+		JobSystem jobs((int)threads - 1);
+		double times[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+		// 1. scheduling overhead: many jobs doing almost nothing
+		times[0] = BenchmarkBestOf(3, [&]() {
+			JobCounter counter;
+			std::atomic<unsigned int> sum(0);
+			for (unsigned int i = 0; i < 100000; i++)
+				jobs.run([&sum, i]() { sum.fetch_add(i & 1, std::memory_order_relaxed); }, &counter);
+			jobs.wait(counter);
+		});
+
+		// 2. compute-bound data parallel loop
+		std::vector<float> values(1 << 20);
+		times[1] = BenchmarkBestOf(3, [&]() {
+			jobs.parallelFor(values.size(), 4096, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+				{
+					float x = (float)i * 0.001f;
+					for (int k = 0; k < 16; k++)
+						x = std::sin(x) * 1.5f + 0.1f;
+					values[i] = x;
+				}
+			});
+		});
+
+		// 3. decoding the model's textures, one job per image
+		if (!texturePaths.empty())
+		{
+			times[2] = BenchmarkBestOf(2, [&]() {
+				jobs.parallelFor(texturePaths.size(), 1, [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++)
+					{
+						TextureImage image;
+						if (DecodeTextureFile(texturePaths[i].c_str(), directory, image))
+							stbi_image_free(image.data);
+					}
+				});
+			});
+		}
+
+		// 4. converting the model's meshes to vertex/index arrays, one job per mesh
+		if (!sceneMeshes.empty())
+		{
+			times[3] = BenchmarkBestOf(3, [&]() {
+				std::vector<MeshData> meshData(sceneMeshes.size());
+				jobs.parallelFor(sceneMeshes.size(), 1, [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++)
+						ExtractMeshData(sceneMeshes[i], meshData[i]);
+				});
+			});
+		}
+
+		if (threads == 1)
+			for (int i = 0; i < 4; i++)
+				base[i] = times[i];
+
+		std::cout << std::setw(7) << threads;
+		for (int i = 0; i < 4; i++)
+		{
+			std::cout << " | " << std::fixed << std::setprecision(2) << std::setw(8) << times[i];
+			if (times[i] > 0.0)
+				std::cout << " (x" << std::setprecision(2) << base[i] / times[i] << ")";
+		}
+		std::cout << std::endl;
+	}
+	return 0;
+}
+
+// --bench-lights: clustered light assignment for 1 to 1024 lights, on one thread and on the job system,
+// and how many lights a fragment loops over compared to a loop over every light
+inline int RunClusteredLightsBenchmark()
+{
+	// the scene's default camera
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1200.0f / 900.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 4.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	JobSystem serial(0), parallel;
+	static const unsigned int counts[] = { 1, 16, 256, 1024 };
+
+	std::cout << "lights | 1 thread (ms) | " << parallel.getWorkerCount() + 1 << " threads (ms) | light indices | lights per cluster (avg / max)" << std::endl;
+	for (unsigned int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		ClusteredLights single, shared;
+		AnimateTestLights(single.lights, counts[i], 0.0f);
+		AnimateTestLights(shared.lights, counts[i], 0.0f);
+		double times[2];
+		times[0] = BenchmarkBestOf(20, [&]() { single.assign(serial, view, projection, 0.1f, 100.0f, 1200.0f, 900.0f); });
+		times[1] = BenchmarkBestOf(20, [&]() { shared.assign(parallel, view, projection, 0.1f, 100.0f, 1200.0f, 900.0f); });
+		std::cout << std::setw(6) << counts[i] << std::fixed << std::setprecision(3)
+			<< " | " << std::setw(13) << times[0] << " | " << std::setw(8) << times[1] << " (x" << std::setprecision(2) << times[0] / times[1] << ")"
+			<< " | " << std::setw(13) << shared.getIndexCount()
+			<< " | " << (double)shared.getIndexCount() / ClusteredLights::CLUSTER_COUNT << " / " << shared.getMaxClusterLights()
+			<< " (vs " << counts[i] << " without clusters)" << std::endl;
+	}
+	return 0;
+}
+
+// --bench-occlusion: the room's walls rasterized as occluders on one thread and on the job system, and
+// how many of a grid of boxes in the room they hide from a camera behind a wall and from one inside
+inline int RunOcclusionBenchmark()
+{
+	// the scene's room: a unit cube without its +Z face, scaled by 10
+	std::vector<float> room;
+	static const float quad[6][2] = { { -0.5f, -0.5f }, { 0.5f, -0.5f }, { 0.5f, 0.5f }, { 0.5f, 0.5f }, { -0.5f, 0.5f }, { -0.5f, -0.5f } };
+	for (int axis = 0; axis < 3; axis++)
+		for (int side = -1; side <= 1; side += 2)
+		{
+			if (axis == 2 && side == 1)
+				continue;
+			for (int k = 0; k < 6; k++)
+			{
+				float p[3];
+				p[axis] = 0.5f * side;
+				p[(axis + 1) % 3] = quad[k][0];
+				p[(axis + 2) % 3] = quad[k][1];
+				room.insert(room.end(), p, p + 3);
+			}
+		}
+	glm::mat4 roomModel;
+	roomModel = glm::scale(roomModel, glm::vec3(10.0f));
+	std::vector<AABB> boxes;
+	for (int x = 0; x < 16; x++)
+		for (int y = 0; y < 16; y++)
+			for (int z = 0; z < 16; z++)
+			{
+				glm::vec3 center = glm::vec3(x, y, z) * 0.5f - glm::vec3(3.75f);
+				boxes.push_back(AABB(center - glm::vec3(0.1f), center + glm::vec3(0.1f)));
+			}
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1200.0f / 900.0f, 0.1f, 100.0f);
+	static const char *names[2] = { "behind the -Z wall", "inside the room" };
+	glm::mat4 views[2] = {
+		glm::lookAt(glm::vec3(1.0f, 2.0f, -15.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+		glm::lookAt(glm::vec3(0.0f, 0.0f, 4.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)) };
+	JobSystem serial(0), parallel;
+	OcclusionCuller single, shared;
+	single.addOccluder(&room[0], room.size() / 3, 3, roomModel);
+	shared.addOccluder(&room[0], room.size() / 3, 3, roomModel);
+
+	std::cout << "camera             | triangles | rasterize 1 thread (ms) | " << parallel.getWorkerCount() + 1
+		<< " threads (ms) | test " << boxes.size() << " boxes (ms) | occluded" << std::endl;
+	for (int v = 0; v < 2; v++)
+	{
+		glm::mat4 viewProjection = projection * views[v];
+		double times[3];
+		times[0] = BenchmarkBestOf(20, [&]() { single.render(serial, viewProjection); });
+		times[1] = BenchmarkBestOf(20, [&]() { shared.render(parallel, viewProjection); });
+		size_t hidden = 0;
+		times[2] = BenchmarkBestOf(20, [&]() {
+			hidden = 0;
+			for (size_t i = 0; i < boxes.size(); i++)
+				hidden += shared.isVisible(boxes[i]) ? 0 : 1;
+		});
+		std::cout << std::left << std::setw(18) << names[v] << std::right << " | " << std::setw(9) << shared.getTriangleCount()
+			<< std::fixed << std::setprecision(3) << " | " << std::setw(23) << times[0] << " | " << std::setw(8) << times[1]
+			<< " (x" << std::setprecision(2) << times[0] / times[1] << ")" << std::setprecision(3) << " | " << std::setw(16) << times[2]
+			<< " | " << hidden << " of " << boxes.size() << std::endl;
+	}
+	return 0;
+}
+
+// --bench-entities: the entity store's systems over 100k entities hanging from 100 parent nodes, with
+// all of them and a tenth of the parents moving: scene graph update, transform update and culling,
+// on one thread and on the job system
+inline int RunEntityBenchmark()
+{
+	static const int PARENTS = 100, CHILDREN = 1000;
+	SceneGraph graph;
+	EntityStore entities;
+	AABB unitBox(-0.5f, 0.5f, -0.5f, 0.5f, -0.5f, 0.5f);
+	std::vector<int> parents;
+	for (int p = 0; p < PARENTS; p++)
+	{
+		glm::mat4 local;
+		local = glm::translate(local, glm::vec3((p % 10) * 10.0f - 45.0f, 0.0f, (p / 10) * 10.0f - 45.0f));
+		parents.push_back(graph.addNode(SceneGraph::NO_PARENT, local));
+		for (int c = 0; c < CHILDREN; c++)
+		{
+			glm::mat4 child;
+			child = glm::translate(child, glm::vec3(c % 10, c / 100, (c / 10) % 10) - glm::vec3(4.5f));
+			child = glm::scale(child, glm::vec3(0.5f));
+			DrawItem item = DrawItem();
+			item.model = child;
+			Renderable object = makeRenderable(item, unitBox);
+			object.node = graph.addNode(parents.back(), child);
+			entities.add(object);
+		}
+	}
+	graph.update();
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1200.0f / 900.0f, 0.1f, 100.0f);
+	Frustum frustum(projection * glm::lookAt(glm::vec3(0.0f, 20.0f, 60.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+	JobSystem serial(0), parallel;
+	std::vector<unsigned char> visible;
+	static const char *names[2] = { "all moving", "1/10 moving" };
+
+	std::cout << entities.size() << " entities, " << graph.size() << " nodes, " << entities.getMemoryBytes() / 1024 << " KB of components" << std::endl;
+	std::cout << "case        | graph update (ms) | updated | transforms 1 thread (ms) | " << parallel.getWorkerCount() + 1
+		<< " threads (ms) | cull 1 thread (ms) | " << parallel.getWorkerCount() + 1 << " threads (ms) | visible" << std::endl;
+	for (int v = 0; v < 2; v++)
+	{
+		int step = v == 0 ? 1 : 10;
+		double times[5];
+		size_t updated = 0, inView = 0;
+		// the changed flags last until the next graph update, so every run of the systems below sees the same set
+		times[0] = BenchmarkBestOf(10, [&]() {
+			for (int p = 0; p < PARENTS; p += step)
+				graph.setLocal(parents[p], glm::rotate(graph.getLocal(parents[p]), 0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+			updated = graph.update();
+		});
+		times[1] = BenchmarkBestOf(10, [&]() { entities.updateTransforms(serial, graph); });
+		times[2] = BenchmarkBestOf(10, [&]() { entities.updateTransforms(parallel, graph); });
+		times[3] = BenchmarkBestOf(10, [&]() { inView = entities.cull(serial, frustum, visible); });
+		times[4] = BenchmarkBestOf(10, [&]() { inView = entities.cull(parallel, frustum, visible); });
+		std::cout << std::left << std::setw(11) << names[v] << std::right << std::fixed << std::setprecision(3)
+			<< " | " << std::setw(17) << times[0] << " | " << std::setw(7) << updated
+			<< " | " << std::setw(24) << times[1] << " | " << std::setw(8) << times[2] << " (x" << std::setprecision(2) << times[1] / times[2] << ")"
+			<< std::setprecision(3) << " | " << std::setw(18) << times[3] << " | " << std::setw(8) << times[4] << " (x" << std::setprecision(2) << times[3] / times[4] << ")"
+			<< " | " << inView << std::endl;
+	}
+	return 0;
+}
+
+// --bench-import: Model::ImportGeometry, the real loader with retention DISCARD and no GL objects, run a few
+// times on the same model on one thread. Reports the time, the allocations served by the import arena and,
+// in builds with BENCHMARK_COUNT_ALLOCATIONS, the heap allocations; the first run grows the arena, later
+// ones find its blocks already there.
+inline int RunImportBenchmark(const std::string &modelPath)
+{
+	ImportArena &arena = ImportArena::local();
+#ifndef BENCHMARK_COUNT_ALLOCATIONS
+	std::cout << "Heap allocations are only counted in builds with BENCHMARK_COUNT_ALLOCATIONS defined" << std::endl;
+#endif
+	std::cout << "run | load (ms) | meshes | arena allocations | heap allocations | per mesh" << std::endl;
+	for (int run = 0; run < 4; run++)
+	{
+		size_t arenaAllocations = arena.getAllocations();
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+		AllocationCount heap;
+#endif
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Model model = Model::ImportGeometry(modelPath, Geometry_Retention::DISCARD);
+		double loadTime = BenchmarkMilliseconds(start);
+		if (model.getState() == Load_State::FAILED)
+			return -1; // the loader has said why
+
+		std::cout << std::setw(3) << run << " | " << std::fixed << std::setprecision(2) << std::setw(9) << loadTime << " | " << std::setw(6)
+			<< model.meshes.size() << " | " << std::setw(17) << arena.getAllocations() - arenaAllocations << " | ";
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+		std::cout << std::setw(16) << heap.get() << " | " << std::setprecision(1) << (double)heap.get() / model.meshes.size() << std::endl;
+#else
+		std::cout << std::setw(16) << "-" << " | -" << std::endl;
+#endif
+	}
+	arena.printStats(std::cout);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "GLHandle.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLUSTERED_LIGHTS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// a point light of the clustered lighting; no light reaches beyond radius
+struct PointLight {
+	glm::vec3 position; // world space
+	float radius;
+	glm::vec3 color;
+};
+
+// Lights orbiting inside the room (the 10x10x10 cube around the origin) at different heights, speeds
+// and colours; the same for the scene and the benchmark. Replaces lights with count lights at time.
+inline void AnimateTestLights(std::vector<PointLight> &lights, unsigned int count, float time)
+{
+	lights.resize(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		// golden-ratio sequences spread the lights evenly without a random generator
+		float a = std::fmod(i * 0.618034f, 1.0f), b = std::fmod(i * 0.754878f, 1.0f), c = std::fmod(i * 0.569840f, 1.0f);
+		float angle = a * 6.2831853f + time * (0.2f + 0.6f * c);
+		float distance = 1.0f + 3.5f * b;
+		lights[i].position = glm::vec3(distance * std::cos(angle), -4.5f + 9.0f * c, distance * std::sin(angle));
+		lights[i].radius = 2.5f;
+		// hue around the colour wheel
+		float red = std::fabs(a * 6.0f - 3.0f) - 1.0f, green = 2.0f - std::fabs(a * 6.0f - 2.0f), blue = 2.0f - std::fabs(a * 6.0f - 4.0f);
+		lights[i].color = glm::vec3(std::min(std::max(red, 0.0f), 1.0f), std::min(std::max(green, 0.0f), 1.0f), std::min(std::max(blue, 0.0f), 1.0f)) * 1.5f;
+	}
+}
+
+// Clustered forward lighting. The view frustum is split into CLUSTERS_X x CLUSTERS_Y screen tiles
+// and CLUSTERS_Z depth slices (exponentially spaced between the near and far plane). Every frame
+// assign() finds the lights overlapping each cluster on the CPU: one job per depth slice, each
+// testing the light spheres against its clusters' view-space bounds four lights at a time. upload()
+// hands the result to the shaders in three texture buffers, and clustered_lights.glsl loops over
+// only the lights of the fragment's cluster:
+// - lights:  two RGBA32F texels per light, (position, radius) and (colour, 0),
+// - grid:    one RG32UI texel per cluster, (first index, light count),
+// - indices: R32UI light indices of all clusters, cluster after cluster.
+// assign() touches no GL and may run on a worker; upload() and bind() must run on the GL thread.
+class ClusteredLights {
+public:
+	// must match clustered_lights.glsl
+	static const int CLUSTERS_X = 16;
+	static const int CLUSTERS_Y = 9;
+	static const int CLUSTERS_Z = 24;
+	static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+	// texture units of the light buffers, above the ones materials use
+	static const unsigned int FIRST_UNIT = 12;
+
+	std::vector<PointLight> lights;
+
+	ClusteredLights() : nearPlane(0.1f), farPlane(100.0f), viewportWidth(1.0f), viewportHeight(1.0f), boundsValid(false), uploaded(false)
+	{
+		grid.resize(CLUSTER_COUNT * 2);
+		slices.resize(CLUSTERS_Z);
+	}
+	ClusteredLights(const ClusteredLights&) = delete;
+	ClusteredLights &operator=(const ClusteredLights&) = delete;
+
+	// Any thread: assigns the lights to the clusters of the view. The cluster bounds are only rebuilt
+	// when the projection or the depth range changes.
+	void assign(JobSystem &jobs, const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane, float viewportWidth, float viewportHeight)
+	{
+		if (!boundsValid || projection != this->projection || nearPlane != this->nearPlane || farPlane != this->farPlane)
+		{
+			this->projection = projection;
+			this->nearPlane = nearPlane;
+			this->farPlane = farPlane;
+			buildClusterBounds();
+			boundsValid = true;
+		}
+		this->viewportWidth = viewportWidth;
+		this->viewportHeight = viewportHeight;
+
+		// view-space spheres
+		lightX.resize(lights.size());
+		lightY.resize(lights.size());
+		lightZ.resize(lights.size());
+		lightRadius.resize(lights.size());
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			glm::vec4 position = view * glm::vec4(lights[i].position, 1.0f);
+			lightX[i] = position.x;
+			lightY[i] = position.y;
+			lightZ[i] = position.z;
+			lightRadius[i] = lights[i].radius;
+		}
+
+		jobs.parallelFor(CLUSTERS_Z, 1, [this](size_t begin, size_t end) {
+			for (size_t z = begin; z < end; z++)
+				assignSlice((int)z);
+		});
+
+		// the slices' index lists, one after the other
+		indices.clear();
+		for (int z = 0; z < CLUSTERS_Z; z++)
+		{
+			const SliceLists &slice = slices[z];
+			uint32_t base = (uint32_t)indices.size();
+			for (int c = 0; c < CLUSTERS_X * CLUSTERS_Y; c++)
+			{
+				int cluster = z * CLUSTERS_X * CLUSTERS_Y + c;
+				grid[cluster * 2] = base + slice.first[c];
+				grid[cluster * 2 + 1] = slice.count[c];
+			}
+			indices.insert(indices.end(), slice.indices.begin(), slice.indices.end());
+		}
+	}
+
+	// GL thread: copies the lights and the last assignment into the texture buffers
+	void upload()
+	{
+		if (!uploaded)
+		{
+			static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+			for (int i = 0; i < 3; i++)
+			{
+				buffers[i] = GLBuffer::create();
+				textures[i] = GLTexture::create();
+				GLStateCache::get().bindTexture(GL_TEXTURE_BUFFER, textures[i].get());
+				glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i].get());
+			}
+			uploaded = true;
+		}
+		packed.resize(lights.size() * 8);
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			float *texels = &packed[i * 8];
+			texels[0] = lights[i].position.x;
+			texels[1] = lights[i].position.y;
+			texels[2] = lights[i].position.z;
+			texels[3] = lights[i].radius;
+			texels[4] = lights[i].color.x;
+			texels[5] = lights[i].color.y;
+			texels[6] = lights[i].color.z;
+			texels[7] = 0.0f;
+		}
+		// texture buffers can't be empty; one zero texel stands in
+		static const uint32_t zero[4] = { 0, 0, 0, 0 };
+		fillBuffer(0, packed.empty() ? (const void*)zero : &packed[0], packed.empty() ? sizeof(zero) : packed.size() * sizeof(float));
+		fillBuffer(1, &grid[0], grid.size() * sizeof(uint32_t));
+		fillBuffer(2, indices.empty() ? zero : &indices[0], indices.empty() ? sizeof(uint32_t) : indices.size() * sizeof(uint32_t));
+	}
+
+	// GL thread: binds the buffers to FIRST_UNIT .. FIRST_UNIT + 2
+	void bind() const
+	{
+		GLStateCache &state = GLStateCache::get();
+		for (unsigned int i = 0; i < 3; i++)
+			state.bindTextureUnit(FIRST_UNIT + i, GL_TEXTURE_BUFFER, textures[i].get());
+	}
+
+	// Any thread: the uniforms clustered_lights.glsl needs, for a pass using the last assignment.
+	// The shaders also read the pass's view matrix.
+	void setUniforms(UniformBlock &uniforms) const
+	{
+		uniforms.setInt("clusterLights", FIRST_UNIT);
+		uniforms.setInt("clusterGrid", FIRST_UNIT + 1);
+		uniforms.setInt("clusterIndices", FIRST_UNIT + 2);
+		uniforms.setFloat("clusterNear", nearPlane);
+		uniforms.setFloat("clusterSliceScale", CLUSTERS_Z / std::log(farPlane / nearPlane));
+		uniforms.setVec3("clusterTileSize", glm::vec3(viewportWidth / CLUSTERS_X, viewportHeight / CLUSTERS_Y, 0.0f));
+	}
+
+	// light indices written by the last assignment, and the most any cluster got
+	size_t getIndexCount() const
+	{
+		return indices.size();
+	}
+	unsigned int getMaxClusterLights() const
+	{
+		unsigned int most = 0;
+		for (int i = 0; i < CLUSTER_COUNT; i++)
+			most = std::max(most, grid[i * 2 + 1]);
+		return most;
+	}
+
+private:
+	// view-space box
+	struct Bounds {
+		float low[3], high[3];
+	};
+
+	// light spheres as structure of arrays, padded to groups of four with spheres beyond every box
+	struct Spheres {
+		std::vector<uint32_t> lights;
+		std::vector<float> x, y, z, radius2;
+
+		void clear()
+		{
+			lights.clear();
+			x.clear();
+			y.clear();
+			z.clear();
+			radius2.clear();
+		}
+		void add(uint32_t light, float cx, float cy, float cz, float r2)
+		{
+			lights.push_back(light);
+			x.push_back(cx);
+			y.push_back(cy);
+			z.push_back(cz);
+			radius2.push_back(r2);
+		}
+		void pad()
+		{
+			while (x.size() & 3)
+			{
+				x.push_back(0.0f);
+				y.push_back(0.0f);
+				z.push_back(1e30f);
+				radius2.push_back(0.0f);
+			}
+		}
+	};
+
+	// light lists of the clusters of one depth slice, written by one job
+	struct SliceLists {
+		std::vector<uint32_t> first, count;
+		std::vector<uint32_t> indices;
+		Spheres slice; // lights reaching into the slice's depth range
+		Spheres row;   // of those, the ones reaching into the current row of tiles
+	};
+
+	glm::mat4 projection;
+	float nearPlane, farPlane;
+	float viewportWidth, viewportHeight;
+	bool boundsValid;
+	// bounds of each cluster, and of each row of tiles in a slice
+	std::vector<Bounds> clusterBounds, rowBounds;
+	std::vector<float> lightX, lightY, lightZ, lightRadius;
+	std::vector<SliceLists> slices;
+	std::vector<uint32_t> grid;
+	std::vector<uint32_t> indices;
+	std::vector<float> packed;
+	bool uploaded;
+	GLBuffer buffers[3];
+	GLTexture textures[3];
+
+	// view depth of the boundary between slice z - 1 and z
+	float sliceDepth(int z) const
+	{
+		return nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTERS_Z);
+	}
+
+	// the view-space point at depth on the line through the near and far plane at ndc (x, y);
+	// works for perspective and orthographic projections
+	static glm::vec3 pointAtDepth(const glm::mat4 &inverseProjection, float x, float y, float depth)
+	{
+		glm::vec4 nearPoint = inverseProjection * glm::vec4(x, y, -1.0f, 1.0f);
+		glm::vec4 farPoint = inverseProjection * glm::vec4(x, y, 1.0f, 1.0f);
+		glm::vec3 a = glm::vec3(nearPoint) / nearPoint.w, b = glm::vec3(farPoint) / farPoint.w;
+		float t = (-depth - a.z) / (b.z - a.z);
+		return a + (b - a) * t;
+	}
+
+	void buildClusterBounds()
+	{
+		glm::mat4 inverseProjection = glm::inverse(projection);
+		clusterBounds.resize(CLUSTER_COUNT);
+		rowBounds.resize(CLUSTERS_Z * CLUSTERS_Y);
+		for (int z = 0; z < CLUSTERS_Z; z++)
+		{
+			float depths[2] = { sliceDepth(z), sliceDepth(z + 1) };
+			for (int y = 0; y < CLUSTERS_Y; y++)
+			{
+				glm::vec3 rowLow(1e30f), rowHigh(-1e30f);
+				for (int x = 0; x < CLUSTERS_X; x++)
+				{
+					glm::vec3 low(1e30f), high(-1e30f);
+					for (int corner = 0; corner < 8; corner++)
+					{
+						float ndcX = (float)(x + (corner & 1)) / CLUSTERS_X * 2.0f - 1.0f;
+						float ndcY = (float)(y + ((corner >> 1) & 1)) / CLUSTERS_Y * 2.0f - 1.0f;
+						glm::vec3 point = pointAtDepth(inverseProjection, ndcX, ndcY, depths[corner >> 2]);
+						low = glm::min(low, point);
+						high = glm::max(high, point);
+					}
+					setBounds(clusterBounds[(z * CLUSTERS_Y + y) * CLUSTERS_X + x], low, high);
+					rowLow = glm::min(rowLow, low);
+					rowHigh = glm::max(rowHigh, high);
+				}
+				setBounds(rowBounds[z * CLUSTERS_Y + y], rowLow, rowHigh);
+			}
+		}
+	}
+
+	static void setBounds(Bounds &bounds, const glm::vec3 &low, const glm::vec3 &high)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			bounds.low[c] = low[c];
+			bounds.high[c] = high[c];
+		}
+	}
+
+	// Narrows the lights down level by level: those reaching the slice's depth range, then for each row
+	// of tiles those reaching the row, then for each tile those reaching its cluster.
+	void assignSlice(int z)
+	{
+		SliceLists &lists = slices[z];
+		const int tiles = CLUSTERS_X * CLUSTERS_Y;
+		lists.first.resize(tiles);
+		lists.count.resize(tiles);
+		lists.indices.clear();
+
+		float sliceNear = -sliceDepth(z), sliceFar = -sliceDepth(z + 1);
+		lists.slice.clear();
+		for (size_t i = 0; i < lights.size(); i++)
+			if (lightZ[i] - lightRadius[i] <= sliceNear && lightZ[i] + lightRadius[i] >= sliceFar)
+				lists.slice.add((uint32_t)i, lightX[i], lightY[i], lightZ[i], lightRadius[i] * lightRadius[i]);
+		lists.slice.pad();
+
+		for (int y = 0; y < CLUSTERS_Y; y++)
+		{
+			const Spheres &slice = lists.slice;
+			lists.row.clear();
+			for (size_t g = 0; g < slice.x.size(); g += 4)
+			{
+				int mask = sphereBoxMask(slice, g, rowBounds[z * CLUSTERS_Y + y]);
+				if (!mask)
+					continue;
+				for (int k = 0; k < 4; k++)
+					if ((mask & (1 << k)) && g + k < slice.lights.size())
+						lists.row.add(slice.lights[g + k], slice.x[g + k], slice.y[g + k], slice.z[g + k], slice.radius2[g + k]);
+			}
+			lists.row.pad();
+
+			const Spheres &row = lists.row;
+			for (int x = 0; x < CLUSTERS_X; x++)
+			{
+				int tile = y * CLUSTERS_X + x;
+				const Bounds &bounds = clusterBounds[z * tiles + tile];
+				lists.first[tile] = (uint32_t)lists.indices.size();
+				for (size_t g = 0; g < row.x.size(); g += 4)
+				{
+					int mask = sphereBoxMask(row, g, bounds);
+					if (!mask)
+						continue;
+					for (int k = 0; k < 4; k++)
+						if ((mask & (1 << k)) && g + k < row.lights.size())
+							lists.indices.push_back(row.lights[g + k]);
+				}
+				lists.count[tile] = (uint32_t)lists.indices.size() - lists.first[tile];
+			}
+		}
+	}
+
+	// bit k is set if sphere first + k overlaps the box: squared distance from its centre to the box <= r^2
+	static int sphereBoxMask(const Spheres &spheres, size_t first, const Bounds &box)
+	{
+		const float *x = &spheres.x[first], *y = &spheres.y[first], *z = &spheres.z[first], *r2 = &spheres.radius2[first];
+#ifdef CLUSTERED_LIGHTS_SSE2
+		__m128 zero = _mm_setzero_ps();
+		__m128 cx = _mm_loadu_ps(x), cy = _mm_loadu_ps(y), cz = _mm_loadu_ps(z);
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(box.low[0]), cx), _mm_sub_ps(cx, _mm_set1_ps(box.high[0]))), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(box.low[1]), cy), _mm_sub_ps(cy, _mm_set1_ps(box.high[1]))), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(box.low[2]), cz), _mm_sub_ps(cz, _mm_set1_ps(box.high[2]))), zero);
+		__m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		return _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(r2)));
+#else
+		int mask = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			float dx = std::max(std::max(box.low[0] - x[k], x[k] - box.high[0]), 0.0f);
+			float dy = std::max(std::max(box.low[1] - y[k], y[k] - box.high[1]), 0.0f);
+			float dz = std::max(std::max(box.low[2] - z[k], z[k] - box.high[2]), 0.0f);
+			if (dx * dx + dy * dy + dz * dz <= r2[k])
+				mask |= 1 << k;
+		}
+		return mask;
+#endif
+	}
+
+	// respecifies the whole store; the texture keeps pointing at the buffer
+	void fillBuffer(int i, const void *data, size_t size)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i].get());
+		glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+};
+
+#endif
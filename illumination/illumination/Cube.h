@@ -6,7 +6,6 @@
 
 class Cube : public Object {
 private:
-	bool is_scene_space_;
 	AABB aabb;
 
 	float width_;
@@ -16,7 +15,7 @@ private:
 
 public:
 	Cube(const glm::vec3 &center, float width, float height, float depth, bool is_scene_space = false)
-		: center_(center), width_(width), height_(height), depth_(depth), is_scene_space_(is_scene_space)
+		: Object(is_scene_space), center_(center), width_(width), height_(height), depth_(depth)
 	{
 		float half_width = width / 2.0f, half_height = height / 2.0f, half_depth = depth / 2.0f;
 		aabb = AABB(center.x - half_width, center.x + half_width,
@@ -24,17 +23,9 @@ public:
 			center.z - half_depth, center.z + half_depth);
 	}
 
-	virtual bool isSceneSpace() const override
-	{
-		return is_scene_space_;
-	}
-
 	bool isCollideWith(const Cube& another) const
 	{
-		if (!another.isSceneSpace())
-			return this->aabb.isOverlap(another.aabb);
-		else
-			return !another.aabb.isContain(this->aabb);
+		return BoxesCollide(this->aabb, another.aabb, another.isSceneSpace());
 	}
 };
 
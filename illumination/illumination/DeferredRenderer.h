@@ -0,0 +1,132 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+
+#include "GLHandle.h"
+#include "GLState.h"
+#include "Material.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+// The deferred path: the scene pass writes surfaces into a compact G-buffer (gbuffer.glsl) instead
+// of lighting them, and a single full-screen pass (deferred_lighting.fs) lights every pixel once,
+// whatever the overdraw. Per pixel it keeps:
+// - albedo and specular intensity:               RGBA8,    4 bytes
+// - octahedral normal, shininess and flags:      RGB10_A2, 4 bytes
+// - depth, from which the position is rebuilt:   24 bits,  4 bytes
+// The point lights come from ClusteredLights, which the lighting pass reads like the forward shaders.
+// GL thread only.
+class DeferredRenderer {
+public:
+	// bytes per pixel of the targets above, as drivers store them
+	static const unsigned int BYTES_PER_PIXEL = 4 + 4 + 4;
+
+	DeferredRenderer() : width(0), height(0)
+	{ }
+	DeferredRenderer(const DeferredRenderer&) = delete;
+	DeferredRenderer &operator=(const DeferredRenderer&) = delete;
+
+	// creates the G-buffer for a width x height framebuffer, once; false if the driver rejects it
+	bool create(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+		albedoSpecular = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+		normalShininess = createTarget(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+		depth = createTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+
+		FBO = GLFramebuffer::create();
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO.get());
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoSpecular.get(), 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalShininess.get(), 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth.get(), 0);
+		GLenum attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, attachments);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+		{
+			std::cout << "ERROR::DEFERRED:: G-buffer framebuffer is not complete" << std::endl;
+			return false;
+		}
+
+		// the lighting pass draws a triangle made up from gl_VertexID, but core profile still wants a VAO
+		emptyVAO = GLVertexArray::create();
+		inputs.addTexture("gAlbedoSpecular", albedoSpecular.get());
+		inputs.addTexture("gNormalShininess", normalShininess.get());
+		inputs.addTexture("gDepth", depth.get());
+		return true;
+	}
+
+	// another texture the lighting shader samples, e.g. the shadow map
+	void addInput(const std::string &sampler, GLuint texture, GLenum target = GL_TEXTURE_2D)
+	{
+		inputs.addTexture(sampler, texture, target);
+	}
+
+	// the scene pass renders into the G-buffer between these two
+	void beginGeometry()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO.get());
+		glViewport(0, 0, width, height);
+		// pixels left at the far plane are skipped by the lighting pass, so the colour needs no clear
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+	void endGeometry()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// lights the G-buffer into the bound framebuffer with shader (fullscreen.vs/deferred_lighting.fs);
+	// uniforms are those of the scene pass
+	void light(const Shader &shader, const UniformBlock &uniforms) const
+	{
+		GLStateCache &state = GLStateCache::get();
+		state.useProgram(shader.getProgramID());
+		uniforms.apply(shader);
+		inputs.setSamplers(shader);
+		inputs.bind();
+		state.bindVertexArray(emptyVAO.get());
+		glDisable(GL_DEPTH_TEST);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+	size_t getMemoryBytes() const
+	{
+		return (size_t)width * height * BYTES_PER_PIXEL;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "G-buffer: " << width << "x" << height << ", " << BYTES_PER_PIXEL << " bytes per pixel (RGBA8 albedo/specular, "
+			<< "RGB10_A2 normal/shininess, 24-bit depth), " << getMemoryBytes() / 1024 << " KB" << std::endl;
+	}
+
+private:
+	int width, height;
+	GLFramebuffer FBO;
+	GLTexture albedoSpecular, normalShininess, depth;
+	GLVertexArray emptyVAO;
+	Material inputs; // the lighting pass's textures
+
+	GLTexture createTarget(GLenum internalFormat, GLenum format, GLenum type)
+	{
+		GLTexture texture = GLTexture::create();
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, texture.get());
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+		// read with texelFetch only
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+};
+
+#endif
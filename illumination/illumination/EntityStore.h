@@ -0,0 +1,243 @@
+#ifndef ENTITY_STORE_H
+#define ENTITY_STORE_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "Material.h"
+#include "Object.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "Shader.h"
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+// how an entity takes part in collision queries
+enum class Collision_Shape {
+	NONE,
+	BOX,       // solid: its world bounds
+	ENCLOSURE  // a space to stay in, like the room: whatever leaves its bounds collides (Cube's scene space)
+};
+
+// one drawable object of the scene as the code building the scene describes it; EntityStore::add
+// scatters it over its tables
+struct Renderable {
+	const Shader *shader;     // shader of the main pass
+	const Shader *gbufferShader; // shader of the deferred path's G-buffer pass, NULL if it has none
+	const Material *material; // may be NULL
+	GLuint vao;
+	GLenum mode;
+	GLint first;
+	GLsizei count;
+	GLint baseVertex;
+	bool indexed;
+	glm::mat4 model;
+	int node;                 // the scene graph node model is the world matrix of, or -1 if it never moves
+	AABB localBounds;
+	Render_Layer layer;       // SOLID or BLENDED in the main pass
+	bool castsShadow;
+	Collision_Shape collision;
+};
+
+inline Renderable makeRenderable(const DrawItem &item, const AABB &localBounds, bool castsShadow = true)
+{
+	Renderable object;
+	object.shader = item.shader;
+	object.gbufferShader = NULL;
+	object.material = item.material;
+	object.vao = item.vao;
+	object.mode = item.mode;
+	object.first = item.first;
+	object.count = item.count;
+	object.baseVertex = item.baseVertex;
+	object.indexed = item.indexed;
+	object.model = item.model;
+	object.node = -1;
+	object.localBounds = localBounds;
+	object.layer = Render_Layer::SOLID;
+	object.castsShadow = castsShadow;
+	object.collision = Collision_Shape::BOX;
+	return object;
+}
+
+// The entities of the scene, one component per table and one table per array, indexed by entity:
+// - transform:       scene graph node and world matrix
+// - bounds:          object-space box and the world box derived from it
+// - mesh reference:  the vertex array and the range drawn from it
+// - material:        shaders, textures, layer and whether it casts shadows
+// - collision shape
+// The systems walk the tables they need front to back and nothing else: the transform update touches
+// transforms and bounds, culling only the world boxes, and the pass recorders (PassRecorder) read
+// bounds first and the mesh and material of the survivors. World boxes are kept up to date by the
+// transform update, so the passes of a frame don't each transform every box again.
+// Entities are added at the end and removed from the end only (resize), which keeps the indices other
+// tables use (PassDesc::hidden) stable. Not thread-safe while it changes; the systems may read it from
+// the workers.
+class EntityStore {
+public:
+	static const size_t CHUNK_SIZE = 1024;
+
+	struct MeshRef {
+		GLuint vao;
+		GLenum mode;
+		GLint first;
+		GLsizei count;
+		GLint baseVertex;
+		bool indexed;
+	};
+
+	struct MaterialRef {
+		const Shader *shader;
+		const Shader *gbufferShader;
+		const Material *material;
+		Render_Layer layer;
+		bool castsShadow;
+	};
+
+	// returns the new entity
+	size_t add(const Renderable &object)
+	{
+		nodes.push_back(object.node);
+		worlds.push_back(object.model);
+		localBounds.push_back(object.localBounds);
+		worldBounds.push_back(object.localBounds.transformed(object.model));
+		MeshRef mesh = { object.vao, object.mode, object.first, object.count, object.baseVertex, object.indexed };
+		meshes.push_back(mesh);
+		MaterialRef material = { object.shader, object.gbufferShader, object.material, object.layer, object.castsShadow };
+		materials.push_back(material);
+		collisions.push_back(object.collision);
+		return nodes.size() - 1;
+	}
+
+	void add(const std::vector<Renderable> &objects)
+	{
+		for (size_t i = 0; i < objects.size(); i++)
+			add(objects[i]);
+	}
+
+	// keeps the first count entities
+	void resize(size_t count)
+	{
+		if (count >= nodes.size())
+			return;
+		nodes.resize(count);
+		worlds.resize(count);
+		localBounds.resize(count);
+		worldBounds.resize(count);
+		meshes.resize(count);
+		materials.resize(count);
+		collisions.resize(count);
+	}
+
+	size_t size() const
+	{
+		return nodes.size();
+	}
+
+	int getNode(size_t entity) const
+	{
+		return nodes[entity];
+	}
+	const glm::mat4 &getWorld(size_t entity) const
+	{
+		return worlds[entity];
+	}
+	const AABB &getWorldBounds(size_t entity) const
+	{
+		return worldBounds[entity];
+	}
+	const MeshRef &getMesh(size_t entity) const
+	{
+		return meshes[entity];
+	}
+	const MaterialRef &getMaterial(size_t entity) const
+	{
+		return materials[entity];
+	}
+	Collision_Shape getCollision(size_t entity) const
+	{
+		return collisions[entity];
+	}
+
+	// transform system: copies the world matrices the last SceneGraph::update() changed and rebuilds
+	// those entities' world boxes; returns how many it updated
+	size_t updateTransforms(JobSystem &jobs, const SceneGraph &graph)
+	{
+		chunkCounts.assign((nodes.size() + CHUNK_SIZE - 1) / CHUNK_SIZE, 0);
+		jobs.parallelFor(nodes.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+			size_t updated = 0;
+			for (size_t i = begin; i < end; i++)
+			{
+				if (nodes[i] < 0 || !graph.isChanged(nodes[i]))
+					continue;
+				worlds[i] = graph.getWorld(nodes[i]);
+				worldBounds[i] = localBounds[i].transformed(worlds[i]);
+				updated++;
+			}
+			chunkCounts[begin / CHUNK_SIZE] = updated;
+		});
+		return sum(chunkCounts);
+	}
+
+	// culling system: per entity, nonzero if its world box is in the frustum; returns how many are
+	size_t cull(JobSystem &jobs, const Frustum &frustum, std::vector<unsigned char> &visible)
+	{
+		visible.resize(nodes.size());
+		chunkCounts.assign((nodes.size() + CHUNK_SIZE - 1) / CHUNK_SIZE, 0);
+		jobs.parallelFor(nodes.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+			size_t count = 0;
+			for (size_t i = begin; i < end; i++)
+			{
+				visible[i] = frustum.isVisible(worldBounds[i]);
+				count += visible[i];
+			}
+			chunkCounts[begin / CHUNK_SIZE] = count;
+		});
+		return sum(chunkCounts);
+	}
+
+	// collision system: the entities a solid box at box collides with
+	void findCollisions(const AABB &box, std::vector<size_t> &out) const
+	{
+		out.clear();
+		for (size_t i = 0; i < collisions.size(); i++)
+			if (collisions[i] != Collision_Shape::NONE && BoxesCollide(box, worldBounds[i], collisions[i] == Collision_Shape::ENCLOSURE))
+				out.push_back(i);
+	}
+
+	size_t getMemoryBytes() const
+	{
+		return nodes.size() * (sizeof(int) + sizeof(glm::mat4) + 2 * sizeof(AABB) + sizeof(MeshRef) + sizeof(MaterialRef) + sizeof(Collision_Shape));
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Entities: " << nodes.size() << ", " << getMemoryBytes() / 1024 << " KB of components" << std::endl;
+	}
+
+private:
+	std::vector<int> nodes;
+	std::vector<glm::mat4> worlds;
+	std::vector<AABB> localBounds;
+	std::vector<AABB> worldBounds;
+	std::vector<MeshRef> meshes;
+	std::vector<MaterialRef> materials;
+	std::vector<Collision_Shape> collisions;
+	std::vector<size_t> chunkCounts; // per chunk results of the parallel systems
+
+	static size_t sum(const std::vector<size_t> &counts)
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < counts.size(); i++)
+			total += counts[i];
+		return total;
+	}
+};
+
+#endif
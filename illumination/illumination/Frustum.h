@@ -0,0 +1,71 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+
+#include <cmath>
+
+// six clip planes extracted from a view-projection matrix (Gribb/Hartmann), normals pointing inwards
+class Frustum {
+public:
+	Frustum()
+	{ }
+	explicit Frustum(const glm::mat4 &viewProjection)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			planes[0][i] = viewProjection[i][3] + viewProjection[i][0]; // left
+			planes[1][i] = viewProjection[i][3] - viewProjection[i][0]; // right
+			planes[2][i] = viewProjection[i][3] + viewProjection[i][1]; // bottom
+			planes[3][i] = viewProjection[i][3] - viewProjection[i][1]; // top
+			planes[4][i] = viewProjection[i][3] + viewProjection[i][2]; // near
+			planes[5][i] = viewProjection[i][3] - viewProjection[i][2]; // far
+		}
+		for (int p = 0; p < 6; p++)
+			planes[p] /= glm::length(glm::vec3(planes[p]));
+	}
+
+	// conservative: false only when the box is completely outside one of the planes
+	bool isVisible(const AABB &box) const
+	{
+		glm::vec3 center = box.getCenter(), extent = box.getExtent();
+		for (int p = 0; p < 6; p++)
+		{
+			glm::vec3 n(planes[p]);
+			float distance = glm::dot(n, center) + planes[p].w;
+			float radius = std::abs(n.x) * extent.x + std::abs(n.y) * extent.y + std::abs(n.z) * extent.z;
+			if (distance + radius < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	// conservative: false only when the shadow the box casts away from a point light at lightPosition,
+	// the box swept to infinity, is completely outside one of the planes. Along p + t (p - light) the
+	// distance to a plane goes from d(p) towards d(p) + t (d(p) - d(light)): it stays outside when
+	// the box is outside and the light is no further out than the box's innermost corner.
+	bool isShadowVisible(const AABB &box, const glm::vec3 &lightPosition) const
+	{
+		glm::vec3 center = box.getCenter(), extent = box.getExtent();
+		for (int p = 0; p < 6; p++)
+		{
+			glm::vec3 n(planes[p]);
+			float inner = glm::dot(n, center) + planes[p].w + std::abs(n.x) * extent.x + std::abs(n.y) * extent.y + std::abs(n.z) * extent.z;
+			if (inner < 0.0f && glm::dot(n, lightPosition) + planes[p].w >= inner)
+				return false;
+		}
+		return true;
+	}
+
+	const glm::vec4 &getPlane(int i) const
+	{
+		return planes[i];
+	}
+
+private:
+	glm::vec4 planes[6];
+};
+
+#endif
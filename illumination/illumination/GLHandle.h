@@ -0,0 +1,144 @@
+#ifndef GL_HANDLE_H
+#define GL_HANDLE_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "GLState.h"
+
+// Owning handles of GL objects: move-only, the object is deleted with the last handle that holds
+// it. An empty handle holds 0. Deleting also tells the state cache, whose cached bindings of the
+// name would otherwise outlive it and hide the bind of a new object that reuses the name.
+// GL thread only, like the objects themselves.
+template <typename Traits>
+class GLHandle {
+public:
+	GLHandle() : id(0)
+	{ }
+	// takes ownership of an existing object
+	explicit GLHandle(GLuint id) : id(id)
+	{ }
+	~GLHandle()
+	{
+		reset();
+	}
+	GLHandle(const GLHandle&) = delete;
+	GLHandle &operator=(const GLHandle&) = delete;
+	GLHandle(GLHandle &&other) noexcept : id(other.id)
+	{
+		other.id = 0;
+	}
+	GLHandle &operator=(GLHandle &&other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			id = other.id;
+			other.id = 0;
+		}
+		return *this;
+	}
+
+	// a new object
+	static GLHandle create()
+	{
+		return GLHandle(Traits::create());
+	}
+
+	GLuint get() const
+	{
+		return id;
+	}
+
+	// deletes the object, if any, and holds id instead
+	void reset(GLuint id = 0)
+	{
+		if (this->id)
+			Traits::destroy(this->id);
+		this->id = id;
+	}
+
+	// gives the object up without deleting it
+	GLuint release()
+	{
+		GLuint released = id;
+		id = 0;
+		return released;
+	}
+
+private:
+	GLuint id;
+};
+
+struct GLBufferTraits {
+	static GLuint create()
+	{
+		GLuint id;
+		glGenBuffers(1, &id);
+		return id;
+	}
+	static void destroy(GLuint id)
+	{
+		glDeleteBuffers(1, &id);
+	}
+};
+
+struct GLVertexArrayTraits {
+	static GLuint create()
+	{
+		GLuint id;
+		glGenVertexArrays(1, &id);
+		return id;
+	}
+	static void destroy(GLuint id)
+	{
+		GLStateCache::get().forgetVertexArray(id);
+		glDeleteVertexArrays(1, &id);
+	}
+};
+
+struct GLTextureTraits {
+	static GLuint create()
+	{
+		GLuint id;
+		glGenTextures(1, &id);
+		return id;
+	}
+	static void destroy(GLuint id)
+	{
+		GLStateCache::get().forgetTexture(id);
+		glDeleteTextures(1, &id);
+	}
+};
+
+struct GLFramebufferTraits {
+	static GLuint create()
+	{
+		GLuint id;
+		glGenFramebuffers(1, &id);
+		return id;
+	}
+	static void destroy(GLuint id)
+	{
+		glDeleteFramebuffers(1, &id);
+	}
+};
+
+struct GLProgramTraits {
+	static GLuint create()
+	{
+		return glCreateProgram();
+	}
+	static void destroy(GLuint id)
+	{
+		GLStateCache::get().forgetProgram(id);
+		glDeleteProgram(id);
+	}
+};
+
+typedef GLHandle<GLBufferTraits> GLBuffer;
+typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+typedef GLHandle<GLTextureTraits> GLTexture;
+typedef GLHandle<GLFramebufferTraits> GLFramebuffer;
+typedef GLHandle<GLProgramTraits> GLProgram;
+
+#endif
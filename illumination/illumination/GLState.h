@@ -0,0 +1,216 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <cstring>
+#include <iostream>
+
+// number of state changes forwarded to the driver and number filtered as redundant
+struct GLStateCounter {
+	unsigned int issued;
+	unsigned int skipped;
+};
+
+struct GLStateStats {
+	GLStateCounter program;
+	GLStateCounter vertexArray;
+	GLStateCounter activeTexture;
+	GLStateCounter texture;
+
+	unsigned int totalIssued() const
+	{
+		return program.issued + vertexArray.issued + activeTexture.issued + texture.issued;
+	}
+	unsigned int totalSkipped() const
+	{
+		return program.skipped + vertexArray.skipped + activeTexture.skipped + texture.skipped;
+	}
+};
+
+// Thin shadow copy of the bind points the renderer touches every draw. All glUseProgram,
+// glBindVertexArray, glActiveTexture and glBindTexture calls go through here so that a
+// call which would not change anything never reaches the driver.
+// Code that changes these bindings behind the cache's back must call invalidate().
+class GLStateCache {
+public:
+	static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+	static GLStateCache& get()
+	{
+		static GLStateCache cache;
+		return cache;
+	}
+
+	void useProgram(GLuint program)
+	{
+		if (programValid && currentProgram == program)
+		{
+			current.program.skipped++;
+			return;
+		}
+		glUseProgram(program);
+		currentProgram = program;
+		programValid = true;
+		current.program.issued++;
+	}
+
+	void bindVertexArray(GLuint vao)
+	{
+		if (vertexArrayValid && currentVertexArray == vao)
+		{
+			current.vertexArray.skipped++;
+			return;
+		}
+		glBindVertexArray(vao);
+		currentVertexArray = vao;
+		vertexArrayValid = true;
+		current.vertexArray.issued++;
+	}
+
+	// unit is GL_TEXTURE0 + i, like glActiveTexture
+	void activeTexture(GLenum unit)
+	{
+		if (activeUnitValid && activeUnit == unit)
+		{
+			current.activeTexture.skipped++;
+			return;
+		}
+		glActiveTexture(unit);
+		activeUnit = unit;
+		activeUnitValid = true;
+		current.activeTexture.issued++;
+	}
+
+	// binds to the currently active unit, like glBindTexture
+	void bindTexture(GLenum target, GLuint texture)
+	{
+		int slot = targetSlot(target);
+		unsigned int unit = activeUnit - GL_TEXTURE0;
+		if (slot < 0 || !activeUnitValid || unit >= MAX_TEXTURE_UNITS)
+		{
+			// untracked target or unit: forward and forget what we knew about this unit
+			glBindTexture(target, texture);
+			if (activeUnitValid && unit < MAX_TEXTURE_UNITS)
+				std::memset(textureValid[unit], 0, sizeof(textureValid[unit]));
+			current.texture.issued++;
+			return;
+		}
+		if (textureValid[unit][slot] && boundTextures[unit][slot] == texture)
+		{
+			current.texture.skipped++;
+			return;
+		}
+		glBindTexture(target, texture);
+		boundTextures[unit][slot] = texture;
+		textureValid[unit][slot] = true;
+		current.texture.issued++;
+	}
+
+	// binds texture to the given unit index, without touching the active unit when the binding is already in place
+	void bindTextureUnit(unsigned int unit, GLenum target, GLuint texture)
+	{
+		int slot = targetSlot(target);
+		if (slot >= 0 && unit < MAX_TEXTURE_UNITS && textureValid[unit][slot] && boundTextures[unit][slot] == texture)
+		{
+			current.texture.skipped++;
+			return;
+		}
+		activeTexture(GL_TEXTURE0 + unit);
+		bindTexture(target, texture);
+	}
+
+	// forget all cached bindings, e.g. after code that bound objects directly
+	void invalidate()
+	{
+		programValid = false;
+		vertexArrayValid = false;
+		activeUnitValid = false;
+		std::memset(textureValid, 0, sizeof(textureValid));
+	}
+
+	// an object is about to be deleted: GL unbinds a deleted vertex array or texture, and the next
+	// object may get its name, so a binding cached for it must not be trusted any more
+	void forgetVertexArray(GLuint vao)
+	{
+		if (vertexArrayValid && currentVertexArray == vao)
+			vertexArrayValid = false;
+	}
+	void forgetTexture(GLuint texture)
+	{
+		for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+			for (int slot = 0; slot < TARGET_COUNT; slot++)
+				if (boundTextures[unit][slot] == texture)
+					textureValid[unit][slot] = false;
+	}
+	void forgetProgram(GLuint program)
+	{
+		if (programValid && currentProgram == program)
+			programValid = false;
+	}
+
+	// call once at the start of each frame: the counters collected so far become the last frame's statistics
+	void beginFrame()
+	{
+		lastFrame = current;
+		std::memset(&current, 0, sizeof(current));
+	}
+
+	// statistics of the last completed frame
+	const GLStateStats& frameStats() const
+	{
+		return lastFrame;
+	}
+
+	void printFrameStats(std::ostream &out) const
+	{
+		out << "GL state: issued " << lastFrame.totalIssued() << ", skipped " << lastFrame.totalSkipped()
+			<< " (program " << lastFrame.program.issued << "/" << lastFrame.program.skipped
+			<< ", vao " << lastFrame.vertexArray.issued << "/" << lastFrame.vertexArray.skipped
+			<< ", active texture " << lastFrame.activeTexture.issued << "/" << lastFrame.activeTexture.skipped
+			<< ", texture " << lastFrame.texture.issued << "/" << lastFrame.texture.skipped << ")" << std::endl;
+	}
+
+private:
+	static const int TARGET_COUNT = 3;
+
+	GLuint currentProgram;
+	GLuint currentVertexArray;
+	GLenum activeUnit;
+	bool programValid;
+	bool vertexArrayValid;
+	bool activeUnitValid;
+	GLuint boundTextures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+	bool textureValid[MAX_TEXTURE_UNITS][TARGET_COUNT];
+
+	GLStateStats current;
+	GLStateStats lastFrame;
+
+	GLStateCache()
+		: currentProgram(0), currentVertexArray(0), activeUnit(GL_TEXTURE0)
+	{
+		invalidate();
+		std::memset(boundTextures, 0, sizeof(boundTextures));
+		std::memset(&current, 0, sizeof(current));
+		std::memset(&lastFrame, 0, sizeof(lastFrame));
+	}
+	GLStateCache(const GLStateCache&) = delete;
+	GLStateCache& operator=(const GLStateCache&) = delete;
+
+	static int targetSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D:
+			return 0;
+		case GL_TEXTURE_CUBE_MAP:
+			return 1;
+		case GL_TEXTURE_2D_ARRAY:
+			return 2;
+		default:
+			return -1;
+		}
+	}
+};
+
+#endif
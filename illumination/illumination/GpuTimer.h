@@ -0,0 +1,87 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+// GPU time of the commands issued between begin() and end(), measured with GL_TIME_ELAPSED
+// queries (core since GL 3.3), or another query target such as GL_SAMPLES_PASSED. A result is read
+// back LATENCY frames after it was issued, when the GPU is long done with it, so the CPU never
+// waits. Only one query per target may be running at a time.
+// GL thread only.
+class GpuTimer {
+public:
+	static const unsigned int LATENCY = 4;
+
+	explicit GpuTimer(GLenum target = GL_TIME_ELAPSED) : target(target), created(false), frame(0), total(0.0), samples(0)
+	{
+		for (unsigned int i = 0; i < LATENCY; i++)
+		{
+			queries[i] = 0;
+			pending[i] = false;
+		}
+	}
+	~GpuTimer()
+	{
+		if (created)
+			glDeleteQueries(LATENCY, queries);
+	}
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer &operator=(const GpuTimer&) = delete;
+
+	void begin()
+	{
+		if (!created)
+		{
+			glGenQueries(LATENCY, queries);
+			created = true;
+		}
+		unsigned int slot = frame % LATENCY;
+		if (pending[slot])
+			collect(slot);
+		glBeginQuery(target, queries[slot]);
+	}
+
+	void end()
+	{
+		glEndQuery(target);
+		pending[frame % LATENCY] = true;
+		frame++;
+	}
+
+	// average over the frames read back since the last reset(), in the query's unit
+	double getAverage() const
+	{
+		return samples ? total / samples : 0.0;
+	}
+	// the same for GL_TIME_ELAPSED, whose unit is the nanosecond
+	double getMilliseconds() const
+	{
+		return getAverage() / 1e6;
+	}
+
+	void reset()
+	{
+		total = 0.0;
+		samples = 0;
+	}
+
+private:
+	GLenum target;
+	GLuint queries[LATENCY];
+	bool pending[LATENCY];
+	bool created;
+	unsigned int frame;
+	double total;
+	unsigned int samples;
+
+	void collect(unsigned int slot)
+	{
+		GLuint64 result = 0;
+		glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &result);
+		total += (double)result;
+		samples++;
+		pending[slot] = false;
+	}
+};
+
+#endif
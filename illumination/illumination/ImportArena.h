@@ -0,0 +1,159 @@
+#ifndef IMPORT_ARENA_H
+#define IMPORT_ARENA_H
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Linear allocator for the temporaries of a model import: allocating bumps an offset into the current
+// block, freeing does nothing, and a Scope takes back everything allocated during its lifetime when it
+// ends. The blocks are kept, so once the arena has grown to what a model needs, importing another of
+// that size allocates nothing from the heap for its temporaries.
+// One per thread (local()): an import runs on one thread, loadModel on the main thread and the worker
+// half of a streamed load on a worker. Scopes nest, so an import that runs as a job while another waits
+// on the same thread is fine. Containers use it through ArenaAllocator and must be gone before their
+// scope ends; anything that outlives the import (the meshes' geometry) stays on the heap.
+class ImportArena {
+public:
+	static const size_t BLOCK_SIZE = 256 << 10;
+
+	// everything allocated from arena while it lives is released when it dies
+	class Scope {
+	public:
+		explicit Scope(ImportArena &arena) : arena(arena), block(arena.current), offset(arena.offset), used(arena.used)
+		{ }
+		~Scope()
+		{
+			arena.current = block;
+			arena.offset = offset;
+			arena.used = used;
+		}
+		Scope(const Scope&) = delete;
+		Scope &operator=(const Scope&) = delete;
+
+	private:
+		ImportArena &arena;
+		size_t block, offset, used;
+	};
+
+	ImportArena() : current(0), offset(0), used(0), peak(0), allocations(0)
+	{ }
+	ImportArena(const ImportArena&) = delete;
+	ImportArena &operator=(const ImportArena&) = delete;
+
+	// the calling thread's arena
+	static ImportArena &local()
+	{
+		static thread_local ImportArena arena;
+		return arena;
+	}
+
+	// alignment is a power of two, at most that of std::max_align_t
+	void *allocate(size_t size, size_t alignment)
+	{
+		allocations++;
+		for (;;)
+		{
+			if (current == blocks.size())
+			{
+				Block block;
+				block.size = BLOCK_SIZE;
+				if (size + alignment > block.size)
+					block.size = size + alignment;
+				block.memory.reset(new unsigned char[block.size]);
+				blocks.push_back(std::move(block));
+			}
+			size_t start = (offset + alignment - 1) & ~(alignment - 1);
+			if (start + size <= blocks[current].size)
+			{
+				offset = start + size;
+				used += size;
+				if (used > peak)
+					peak = used;
+				return blocks[current].memory.get() + start;
+			}
+			// the rest of this block is left for the next scope; on to the next one, kept or new
+			current++;
+			offset = 0;
+		}
+	}
+
+	// bytes held in blocks, in use or not
+	size_t getReservedBytes() const
+	{
+		size_t bytes = 0;
+		for (size_t i = 0; i < blocks.size(); i++)
+			bytes += blocks[i].size;
+		return bytes;
+	}
+
+	size_t getPeakBytes() const
+	{
+		return peak;
+	}
+
+	// allocations served since the arena was created
+	size_t getAllocations() const
+	{
+		return allocations;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Import arena: " << getReservedBytes() / 1024 << " KB in " << blocks.size() << " blocks, peak " << peak / 1024
+			<< " KB in use, " << allocations << " allocations served" << std::endl;
+	}
+
+private:
+	struct Block {
+		std::unique_ptr<unsigned char[]> memory;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t current; // block allocations come from
+	size_t offset;  // in it
+	size_t used;
+	size_t peak;
+	size_t allocations;
+};
+
+// std allocator over an ImportArena, for the containers of an import
+template <typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(ImportArena &arena) : arena(&arena)
+	{ }
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena)
+	{ }
+
+	T *allocate(size_t n)
+	{
+		return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T*, size_t)
+	{ }
+
+	ImportArena *arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+	return a.arena == b.arena;
+}
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+	return a.arena != b.arena;
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+// Counts jobs that have been started but not finished. Wait on it to join them, or
+// pass it as the dependency of other jobs so they only start once it drops to zero.
+// A counter may only be destroyed after JobSystem::wait returned on it.
+class JobCounter {
+public:
+	JobCounter() : pending(0)
+	{ }
+
+	bool isDone() const
+	{
+		return pending.load(std::memory_order_acquire) == 0;
+	}
+
+private:
+	friend class JobSystem;
+	struct Continuation {
+		JobSystem *system;
+		void *job;
+	};
+
+	std::atomic<int> pending;
+	std::mutex continuationLock;
+	std::vector<Continuation> continuations;
+
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+};
+
+// Work-stealing job scheduler.
+// Every worker owns a Chase-Lev deque: it pushes and pops at the bottom, idle workers
+// steal from the top of the others. The thread that creates the system owns deque 0
+// and runs jobs itself while it waits. Jobs posted with runOnMainThread only ever run
+// on that thread (in pumpMainThreadJobs or wait), which is where all GL calls must go.
+class JobSystem {
+public:
+	// workerCount < 0 means one worker per hardware thread besides the calling one;
+	// 0 is valid and makes the calling thread run everything inside wait()
+	explicit JobSystem(int workerCount = -1)
+		: stopping(false), injectedCount(0), mainThread(std::this_thread::get_id()), sleepers(0)
+	{
+		if (workerCount < 0)
+		{
+			unsigned int hardware = std::thread::hardware_concurrency();
+			workerCount = hardware > 1 ? (int)hardware - 1 : 1;
+		}
+		for (int i = 0; i <= workerCount; i++)
+			deques.push_back(new WorkStealingDeque());
+
+		previousSlot = threadSlot();
+		threadSlot().system = this;
+		threadSlot().index = 0;
+		for (int i = 1; i <= workerCount; i++)
+			workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepLock);
+			stopping.store(true);
+		}
+		wakeup.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+		// run whatever is left so counters reach zero
+		while (runOne())
+			;
+		pumpMainThreadJobs();
+		threadSlot() = previousSlot;
+		for (unsigned int i = 0; i < deques.size(); i++)
+			delete deques[i];
+	}
+
+	unsigned int getWorkerCount() const
+	{
+		return (unsigned int)workers.size();
+	}
+
+	// total threads executing jobs, including the main thread
+	unsigned int getThreadCount() const
+	{
+		return (unsigned int)deques.size();
+	}
+
+	bool isMainThread() const
+	{
+		return std::this_thread::get_id() == mainThread;
+	}
+
+	// schedules job; counter (if any) is incremented now and decremented when the job has run.
+	// With a dependency the job is held back until that counter is done.
+	void run(const std::function<void()> &job, JobCounter *counter = NULL, JobCounter *dependency = NULL)
+	{
+		schedule(new Job{ job, counter, false }, dependency);
+	}
+
+	// like run, but the job only executes on the thread that created the system
+	void runOnMainThread(const std::function<void()> &job, JobCounter *counter = NULL, JobCounter *dependency = NULL)
+	{
+		schedule(new Job{ job, counter, true }, dependency);
+	}
+
+	// runs queued main-thread jobs until none is left or the time budget (seconds, < 0: unlimited) is spent
+	unsigned int pumpMainThreadJobs(double budget = -1.0)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		unsigned int executed = 0;
+		for (;;)
+		{
+			if (budget >= 0.0 && executed > 0 &&
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= budget)
+				break;
+			Job *job = NULL;
+			{
+				std::lock_guard<std::mutex> lock(mainThreadLock);
+				if (mainThreadJobs.empty())
+					break;
+				job = mainThreadJobs.front();
+				mainThreadJobs.pop_front();
+			}
+			execute(job);
+			executed++;
+		}
+		return executed;
+	}
+
+	// blocks until every job attached to counter has finished, running other jobs in the meantime
+	void wait(JobCounter &counter)
+	{
+		bool onMainThread = isMainThread();
+		while (!counter.isDone())
+		{
+			if (onMainThread && pumpMainThreadJobs(0.0) > 0)
+				continue;
+			if (!runOne())
+				std::this_thread::yield();
+		}
+		// the job that finished last may still be releasing continuations: let it leave before the counter can go away
+		std::lock_guard<std::mutex> lock(counter.continuationLock);
+	}
+
+	// calls body(begin, end) over [0, count) split into chunks of at most chunkSize, and waits for all of them
+	void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)> &body)
+	{
+		JobCounter counter;
+		for (size_t begin = 0; begin < count; begin += chunkSize)
+		{
+			size_t end = begin + chunkSize < count ? begin + chunkSize : count;
+			run([&body, begin, end]() { body(begin, end); }, &counter);
+		}
+		wait(counter);
+	}
+
+private:
+	struct Job {
+		std::function<void()> function;
+		JobCounter *counter;
+		bool mainThreadOnly;
+	};
+
+	// Chase-Lev deque with a fixed ring; push fails when full and the caller runs the job inline
+	class WorkStealingDeque {
+	public:
+		static const int64_t CAPACITY = 4096;
+
+		WorkStealingDeque() : top(0), bottom(0)
+		{
+			for (int64_t i = 0; i < CAPACITY; i++)
+				buffer[i].store(NULL, std::memory_order_relaxed);
+		}
+
+		// owner only
+		bool push(Job *job)
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			int64_t t = top.load(std::memory_order_acquire);
+			if (b - t >= CAPACITY)
+				return false;
+			buffer[b & (CAPACITY - 1)].store(job, std::memory_order_release);
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// owner only
+		Job *pop()
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+			if (t > b)
+			{
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return NULL;
+			}
+			Job *job = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+			if (t == b)
+			{
+				// last element: race against thieves
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					job = NULL;
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+			return job;
+		}
+
+		// any thread
+		Job *steal()
+		{
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom.load(std::memory_order_acquire);
+			if (t >= b)
+				return NULL;
+			Job *job = buffer[t & (CAPACITY - 1)].load(std::memory_order_acquire);
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return NULL;
+			return job;
+		}
+
+	private:
+		std::atomic<int64_t> top;
+		std::atomic<int64_t> bottom;
+		std::atomic<Job*> buffer[CAPACITY];
+	};
+
+	struct ThreadSlot {
+		JobSystem *system;
+		int index;
+	};
+
+	std::vector<WorkStealingDeque*> deques;
+	std::vector<std::thread> workers;
+	std::atomic<bool> stopping;
+
+	// jobs posted from threads that own no deque
+	std::mutex injectionLock;
+	std::deque<Job*> injected;
+	std::atomic<int> injectedCount; // lets idle threads skip the lock
+
+	std::mutex mainThreadLock;
+	std::deque<Job*> mainThreadJobs;
+	std::thread::id mainThread;
+
+	std::mutex sleepLock;
+	std::condition_variable wakeup;
+	std::atomic<int> sleepers;
+
+	ThreadSlot previousSlot;
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	static ThreadSlot &threadSlot()
+	{
+		static thread_local ThreadSlot slot = { NULL, -1 };
+		return slot;
+	}
+
+	// index of the calling thread's deque, or -1 if it doesn't own one
+	int currentIndex() const
+	{
+		const ThreadSlot &slot = threadSlot();
+		return slot.system == this ? slot.index : -1;
+	}
+
+	void schedule(Job *job, JobCounter *dependency)
+	{
+		if (job->counter)
+			job->counter->pending.fetch_add(1, std::memory_order_relaxed);
+		if (dependency && !dependency->isDone())
+		{
+			std::lock_guard<std::mutex> lock(dependency->continuationLock);
+			// re-check under the lock: finish() releases continuations while holding it
+			if (!dependency->isDone())
+			{
+				dependency->continuations.push_back(JobCounter::Continuation{ this, job });
+				return;
+			}
+		}
+		enqueue(job);
+	}
+
+	void enqueue(Job *job)
+	{
+		if (job->mainThreadOnly)
+		{
+			std::lock_guard<std::mutex> lock(mainThreadLock);
+			mainThreadJobs.push_back(job);
+			return;
+		}
+		int index = currentIndex();
+		if (index >= 0)
+		{
+			if (!deques[index]->push(job))
+			{
+				execute(job); // deque full: run it right here
+				return;
+			}
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(injectionLock);
+			injected.push_back(job);
+			injectedCount.fetch_add(1, std::memory_order_release);
+		}
+		if (sleepers.load(std::memory_order_relaxed) > 0)
+			wakeup.notify_one();
+	}
+
+	void execute(Job *job)
+	{
+		job->function();
+		JobCounter *counter = job->counter;
+		delete job;
+		if (counter)
+			finish(*counter);
+	}
+
+	void finish(JobCounter &counter)
+	{
+		// fast path: not the last job, nobody can be waiting for this decrement
+		int value = counter.pending.load(std::memory_order_relaxed);
+		while (value > 1)
+		{
+			if (counter.pending.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+				return;
+		}
+		std::vector<JobCounter::Continuation> released;
+		{
+			std::lock_guard<std::mutex> lock(counter.continuationLock);
+			if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				released.swap(counter.continuations);
+		}
+		for (unsigned int i = 0; i < released.size(); i++)
+			released[i].system->enqueue(static_cast<Job*>(released[i].job));
+	}
+
+	Job *findJob(int index)
+	{
+		Job *job = NULL;
+		if (index >= 0)
+			job = deques[index]->pop();
+		if (!job && injectedCount.load(std::memory_order_acquire) > 0)
+		{
+			std::lock_guard<std::mutex> lock(injectionLock);
+			if (!injected.empty())
+			{
+				job = injected.front();
+				injected.pop_front();
+				injectedCount.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+		if (!job)
+		{
+			// steal, starting next to ourselves so thieves spread over the victims
+			unsigned int count = (unsigned int)deques.size();
+			unsigned int start = index >= 0 ? (unsigned int)index + 1 : 0;
+			for (unsigned int i = 0; i < count && !job; i++)
+			{
+				unsigned int victim = (start + i) % count;
+				if ((int)victim != index)
+					job = deques[victim]->steal();
+			}
+		}
+		return job;
+	}
+
+	bool runOne()
+	{
+		Job *job = findJob(currentIndex());
+		if (!job)
+			return false;
+		execute(job);
+		return true;
+	}
+
+	void workerLoop(int index)
+	{
+		threadSlot().system = this;
+		threadSlot().index = index;
+		unsigned int idleRounds = 0;
+		while (!stopping.load(std::memory_order_acquire))
+		{
+			if (runOne())
+			{
+				idleRounds = 0;
+				continue;
+			}
+			if (++idleRounds < 64)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			// nothing to do for a while: sleep until a push wakes us (the timeout covers lost wake-ups)
+			std::unique_lock<std::mutex> lock(sleepLock);
+			sleepers.fetch_add(1);
+			wakeup.wait_for(lock, std::chrono::milliseconds(2));
+			sleepers.fetch_sub(1);
+			idleRounds = 0;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "Shader.h"
+#include "GLState.h"
+
+#include <string>
+#include <vector>
+
+// a texture bound to a fixed unit and announced to the shader through a sampler uniform
+struct TextureBinding {
+	std::string sampler;
+	unsigned int unit;
+	GLenum target;
+	GLuint id;
+};
+
+// The textures a draw needs, identified by a small integer so draws sharing
+// the same textures can be grouped by the render queue.
+class Material {
+public:
+	std::vector<TextureBinding> textures;
+
+	Material() : id(nextId())
+	{ }
+
+	unsigned int getID() const
+	{
+		return id;
+	}
+
+	void addTexture(const std::string &sampler, GLuint texture, GLenum target = GL_TEXTURE_2D)
+	{
+		TextureBinding binding;
+		binding.sampler = sampler;
+		binding.unit = (unsigned int)textures.size();
+		binding.target = target;
+		binding.id = texture;
+		textures.push_back(binding);
+	}
+
+	// points the shader's samplers at our units; only needed when the program or material changes
+	void setSamplers(const Shader &shader) const
+	{
+		for (unsigned int i = 0; i < textures.size(); i++)
+			shader.setInt(textures[i].sampler, textures[i].unit);
+	}
+
+	void bind() const
+	{
+		GLStateCache &state = GLStateCache::get();
+		for (unsigned int i = 0; i < textures.size(); i++)
+			state.bindTextureUnit(textures[i].unit, textures[i].target, textures[i].id);
+	}
+
+private:
+	unsigned int id;
+
+	static unsigned int nextId()
+	{
+		static unsigned int counter = 0;
+		return ++counter;
+	}
+};
+
+#endif
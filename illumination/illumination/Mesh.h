@@ -7,11 +7,17 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Shader.h"
+#include "GLHandle.h"
+#include "GLState.h"
+#include "AABB.h"
+#include "Material.h"
+#include "RenderQueue.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
 #include <vector>
 
 struct Vertex {
@@ -33,89 +39,173 @@ struct Texture {
 	std::string path;
 };
 
+// what a mesh keeps of its geometry on the CPU once the GPU holds it (Mesh::releaseGeometry)
+enum class Geometry_Retention {
+	DISCARD,   // nothing: drawing only needs the buffers and the counts
+	POSITIONS, // positions and indices, for collision and picking
+	ALL        // vertices and indices, e.g. to build a ModelBatch from or to edit
+};
+const char *const GEOMETRY_RETENTION_NAMES[3] = { "none", "positions", "all" };
+
+// what a new mesh does with its GL buffers
+enum class Mesh_Buffers {
+	FILLED,    // created and filled with the geometry
+	ALLOCATED, // created empty, filled later, e.g. by an UploadManager
+	NONE       // not created: the mesh only holds geometry on the CPU and can't be drawn (Model::ImportGeometry)
+};
+
+// A mesh owns its vertex array and buffers and deletes them with itself. It is move-only: moving
+// hands the GL objects and the geometry over without copying either.
 class Mesh {
 public:
 	/*  Mesh Data  */
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
-	unsigned int VAO;
+	std::vector<Vertex> vertices;      // empty once released, unless Geometry_Retention::ALL
+	std::vector<unsigned int> indices; // empty once released with Geometry_Retention::DISCARD
+	std::vector<glm::vec3> positions;  // filled by a release with Geometry_Retention::POSITIONS
+	std::vector<Texture> textures; // not owned: the model's, or shared placeholders
+	Material material;
+	AABB bounds; // object space
+	int node;    // index of the node it hangs from in its model's hierarchy (Model::nodes)
 
 	/*  Functions  */
-	// constructor
-	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+	// constructor; pass the vectors with std::move to hand them over without a copy.
+	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, Mesh_Buffers buffers = Mesh_Buffers::FILLED)
+		: vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), node(0)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-		
-		std::cout << "" << textures.size() << std::endl;
+		vertexCount = (GLsizei)this->vertices.size();
+		indexCount = (GLsizei)this->indices.size();
+		std::cout << "" << this->textures.size() << std::endl;
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		if (buffers != Mesh_Buffers::NONE)
+			setupMesh(buffers == Mesh_Buffers::FILLED);
+		setupMaterial();
+
+		bounds = AABB::empty();
+		for (unsigned int i = 0; i < this->vertices.size(); i++)
+			bounds.expand(this->vertices[i].Position);
 	}
+	Mesh(Mesh &&other) = default;
+	Mesh &operator=(Mesh &&other) = default;
 
 	// render the mesh
-	void Draw(Shader shader)
+	void Draw(const Shader &shader)
 	{
-		// bind appropriate textures
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
-		unsigned int heightNr = 1;
-		for (unsigned int i = 0; i < textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-											  // retrieve texture number (the N in diffuse_textureN)
-			std::string number;
-			std::string name = textures[i].type;
-			if (name == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (name == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to stream
-			else if (name == "texture_normal")
-				number = std::to_string(normalNr++); // transfer unsigned int to stream
-			else if (name == "texture_height")
-				number = std::to_string(heightNr++); // transfer unsigned int to stream
+		// point the samplers at their units and bind the textures; the state cache skips units that already hold them
+		material.setSamplers(shader);
+		material.bind();
+
+		// draw mesh. The VAO stays bound: the next draw usually binds its own and the cache
+		// drops the bind when it doesn't change, so there's no need to reset state here.
+		GLStateCache::get().bindVertexArray(VAO.get());
+		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+	}
 
-													 // now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.getProgramID(), (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+	// describes the draw for a render queue instead of issuing it
+	DrawItem makeDrawItem(const Shader &shader, const glm::mat4 &model) const
+	{
+		DrawItem item;
+		item.shader = &shader;
+		item.material = &material;
+		item.vao = VAO.get();
+		item.mode = GL_TRIANGLES;
+		item.first = 0;
+		item.count = indexCount;
+		item.baseVertex = 0;
+		item.indexed = true;
+		item.model = model;
+		item.layerMask = 0;
+		return item;
+	}
+
+	// frees the CPU copy of the geometry but what retention keeps; only once the buffers are filled.
+	// Releasing never brings back what an earlier release dropped.
+	void releaseGeometry(Geometry_Retention retention)
+	{
+		if (retention == Geometry_Retention::ALL)
+			return;
+		if (retention == Geometry_Retention::POSITIONS && positions.empty())
+		{
+			positions.reserve(vertices.size());
+			for (unsigned int i = 0; i < vertices.size(); i++)
+				positions.push_back(vertices[i].Position);
+		}
+		std::vector<Vertex>().swap(vertices);
+		if (retention == Geometry_Retention::DISCARD)
+		{
+			std::vector<unsigned int>().swap(indices);
+			std::vector<glm::vec3>().swap(positions);
 		}
+	}
+
+	// bytes of geometry held on the CPU
+	size_t getCpuBytes() const
+	{
+		return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int) + positions.capacity() * sizeof(glm::vec3);
+	}
+
+	// of the buffers, whatever was released
+	GLsizei getVertexCount() const
+	{
+		return vertexCount;
+	}
+	GLsizei getIndexCount() const
+	{
+		return indexCount;
+	}
 
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	unsigned int getVAO() const
+	{
+		return VAO.get();
+	}
+	unsigned int getVBO() const
+	{
+		return VBO.get();
+	}
+	unsigned int getEBO() const
+	{
+		return EBO.get();
+	}
 
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+	// swaps the texture that was loaded from path (e.g. a streaming placeholder) for id;
+	// textures and material units are kept in the same order, so both are patched in place
+	void replaceTexture(const std::string &path, unsigned int id)
+	{
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			if (textures[i].path == path)
+			{
+				textures[i].id = id;
+				material.textures[i].id = id;
+			}
+		}
 	}
 
 private:
 	/*  Render data  */
-	unsigned int VBO, EBO;
+	GLVertexArray VAO;
+	GLBuffer VBO, EBO;
+	GLsizei vertexCount, indexCount;
 
 	/*  Functions    */
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(bool uploadData)
 	{
 		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		VAO = GLVertexArray::create();
+		VBO = GLBuffer::create();
+		EBO = GLBuffer::create();
 
-		glBindVertexArray(VAO);
+		GLStateCache::get().bindVertexArray(VAO.get());
 		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
 		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), uploadData ? vertices.data() : NULL, GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), uploadData ? indices.data() : NULL, GL_STATIC_DRAW);
 
 		// set the vertex attribute pointers
 		// vertex Positions
@@ -134,7 +224,32 @@ private:
 		glEnableVertexAttribArray(4);
 		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
-		glBindVertexArray(0);
+		GLStateCache::get().bindVertexArray(0);
+	}
+
+	// names each texture after the sampler convention (texture_diffuseN, texture_specularN, ...) and assigns units in order
+	void setupMaterial()
+	{
+		unsigned int diffuseNr = 1;
+		unsigned int specularNr = 1;
+		unsigned int normalNr = 1;
+		unsigned int heightNr = 1;
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			// retrieve texture number (the N in diffuse_textureN)
+			std::string number;
+			std::string name = textures[i].type;
+			if (name == "texture_diffuse")
+				number = std::to_string(diffuseNr++);
+			else if (name == "texture_specular")
+				number = std::to_string(specularNr++); // transfer unsigned int to stream
+			else if (name == "texture_normal")
+				number = std::to_string(normalNr++); // transfer unsigned int to stream
+			else if (name == "texture_height")
+				number = std::to_string(heightNr++); // transfer unsigned int to stream
+
+			material.addTexture(name + number, textures[i].id);
+		}
 	}
 };
 
@@ -0,0 +1,299 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// CPU mip chains for the texture cache. Levels are filtered from the previous level in float, one
+// RGBA pixel per SIMD register, and only rounded to 8 bits on output:
+// - colour maps are filtered in linear light (sRGB decoded first, encoded again on output),
+// - linear data (specular maps, alpha) is filtered as is,
+// - normal maps are unpacked to [-1, 1] and renormalized after every level.
+// Thread-safe; the import jobs call it in parallel.
+
+enum class Mip_Content {
+	COLOR,  // sRGB encoded colour
+	LINEAR, // data stored linearly
+	NORMAL  // tangent-space normals packed as 0.5 * n + 0.5
+};
+
+enum class Mip_Filter {
+	BOX,   // 2x2 average
+	KAISER // 8-tap Kaiser-windowed sinc, sharper, fewer aliasing artifacts
+};
+
+struct MipLevel {
+	int width;
+	int height;
+	std::vector<unsigned char> rgba;
+};
+
+// the content of a texture file, by the naming convention of the assets
+inline Mip_Content MipContentForPath(const std::string &path)
+{
+	if (path.find("_ddn") != std::string::npos)
+		return Mip_Content::NORMAL;
+	if (path.find("_spec") != std::string::npos)
+		return Mip_Content::LINEAR;
+	return Mip_Content::COLOR;
+}
+
+inline const char *MipFilterName(Mip_Filter filter)
+{
+	return filter == Mip_Filter::BOX ? "box" : "kaiser";
+}
+
+/*  Colour space  */
+
+inline float SRGBToLinear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float LinearToSRGB(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// 8-bit sRGB to linear
+inline const float *SRGBDecodeTable()
+{
+	static struct Table {
+		float values[256];
+		Table()
+		{
+			for (int i = 0; i < 256; i++)
+				values[i] = SRGBToLinear(i / 255.0f);
+		}
+	} table;
+	return table.values;
+}
+
+// linear in 1/4095 steps to 8-bit sRGB; fine enough to stay within one step of the exact curve
+inline const unsigned char *SRGBEncodeTable()
+{
+	static struct Table {
+		unsigned char values[4096];
+		Table()
+		{
+			for (int i = 0; i < 4096; i++)
+				values[i] = (unsigned char)(LinearToSRGB(i / 4095.0f) * 255.0f + 0.5f);
+		}
+	} table;
+	return table.values;
+}
+
+/*  Filtering  */
+// images are rows of float4 pixels
+
+// weights of the 8 source texels around a destination texel of a 2:1 reduction, at distances -3.5 .. 3.5
+inline const float *KaiserWeights()
+{
+	static struct Weights {
+		float values[8];
+		Weights()
+		{
+			const double alpha = 4.0, pi = 3.14159265358979323846;
+			// zeroth order modified Bessel function of the first kind
+			struct Bessel {
+				static double i0(double x)
+				{
+					double sum = 1.0, term = 1.0;
+					for (int k = 1; k < 20; k++)
+					{
+						term *= (x / (2.0 * k)) * (x / (2.0 * k));
+						sum += term;
+					}
+					return sum;
+				}
+			};
+			double total = 0.0, weights[8];
+			for (int i = 0; i < 8; i++)
+			{
+				double d = i - 3.5;
+				double x = d / 2.0; // in destination texels
+				double sinc = std::fabs(x) < 1e-9 ? 1.0 : std::sin(pi * x) / (pi * x);
+				double r = d / 4.0; // window over the 4 texel half-width
+				double window = Bessel::i0(alpha * std::sqrt(std::max(0.0, 1.0 - r * r))) / Bessel::i0(alpha);
+				weights[i] = sinc * window;
+				total += weights[i];
+			}
+			for (int i = 0; i < 8; i++)
+				values[i] = (float)(weights[i] / total);
+		}
+	} weights;
+	return weights.values;
+}
+
+// source texel index with wrap-around, the textures repeat
+inline int WrapTexel(int i, int size)
+{
+	i %= size;
+	return i < 0 ? i + size : i;
+}
+
+// Reduces one axis by 2 (or keeps a size of 1): reads count pixels spaced stride apart along the axis
+// and writes half as many. Used for rows (stride 1) and for columns (stride width).
+inline void FilterAxis(const float *source, int count, int stride, float *target, int targetStride, Mip_Filter filter)
+{
+	int targetCount = std::max(1, count / 2);
+	if (count == 1)
+	{
+		for (int c = 0; c < 4; c++)
+			target[c] = source[c];
+		return;
+	}
+	const float *kaiser = KaiserWeights();
+	for (int i = 0; i < targetCount; i++)
+	{
+		// taps relative to the first source texel of the destination, with their weights
+		int first, taps;
+		const float *weights;
+		static const float box[2] = { 0.5f, 0.5f };
+		if (filter == Mip_Filter::BOX)
+		{
+			first = 2 * i;
+			taps = 2;
+			weights = box;
+		}
+		else
+		{
+			first = 2 * i - 3;
+			taps = 8;
+			weights = kaiser;
+		}
+#ifdef MIP_GENERATOR_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (int t = 0; t < taps; t++)
+		{
+			const float *pixel = source + (size_t)WrapTexel(first + t, count) * stride * 4;
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pixel), _mm_set1_ps(weights[t])));
+		}
+		_mm_storeu_ps(target + (size_t)i * targetStride * 4, sum);
+#else
+		float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int t = 0; t < taps; t++)
+		{
+			const float *pixel = source + (size_t)WrapTexel(first + t, count) * stride * 4;
+			for (int c = 0; c < 4; c++)
+				sum[c] += pixel[c] * weights[t];
+		}
+		for (int c = 0; c < 4; c++)
+			target[(size_t)i * targetStride * 4 + c] = sum[c];
+#endif
+	}
+}
+
+// next level of a float image: rows first, then columns
+inline void DownsampleFloat(const std::vector<float> &source, int width, int height, Mip_Filter filter, std::vector<float> &target)
+{
+	int targetWidth = std::max(1, width / 2), targetHeight = std::max(1, height / 2);
+	std::vector<float> rows((size_t)targetWidth * height * 4);
+	for (int y = 0; y < height; y++)
+		FilterAxis(&source[(size_t)y * width * 4], width, 1, &rows[(size_t)y * targetWidth * 4], 1, filter);
+	target.resize((size_t)targetWidth * targetHeight * 4);
+	for (int x = 0; x < targetWidth; x++)
+		FilterAxis(&rows[(size_t)x * 4], height, targetWidth, &target[(size_t)x * 4], targetWidth, filter);
+}
+
+inline void RenormalizeNormals(std::vector<float> &pixels)
+{
+	for (size_t i = 0; i < pixels.size(); i += 4)
+	{
+		float x = pixels[i], y = pixels[i + 1], z = pixels[i + 2];
+		float length = std::sqrt(x * x + y * y + z * z);
+		if (length < 1e-6f)
+		{
+			pixels[i] = 0.0f;
+			pixels[i + 1] = 0.0f;
+			pixels[i + 2] = 1.0f;
+		}
+		else
+		{
+			pixels[i] = x / length;
+			pixels[i + 1] = y / length;
+			pixels[i + 2] = z / length;
+		}
+	}
+}
+
+/*  Conversion  */
+
+inline void DecodeMipLevel(const unsigned char *rgba, size_t pixelCount, Mip_Content content, std::vector<float> &pixels)
+{
+	const float *srgb = SRGBDecodeTable();
+	pixels.resize(pixelCount * 4);
+	for (size_t i = 0; i < pixelCount * 4; i += 4)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			if (content == Mip_Content::COLOR)
+				pixels[i + c] = srgb[rgba[i + c]];
+			else if (content == Mip_Content::NORMAL)
+				pixels[i + c] = rgba[i + c] / 127.5f - 1.0f;
+			else
+				pixels[i + c] = rgba[i + c] / 255.0f;
+		}
+		pixels[i + 3] = rgba[i + 3] / 255.0f;
+	}
+}
+
+inline unsigned char QuantizeUnit(float value)
+{
+	return (unsigned char)(std::min(1.0f, std::max(0.0f, value)) * 255.0f + 0.5f);
+}
+
+inline void EncodeMipLevel(const std::vector<float> &pixels, Mip_Content content, std::vector<unsigned char> &rgba)
+{
+	const unsigned char *srgb = SRGBEncodeTable();
+	rgba.resize(pixels.size());
+	for (size_t i = 0; i < pixels.size(); i += 4)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			if (content == Mip_Content::COLOR)
+				rgba[i + c] = srgb[(int)(std::min(1.0f, std::max(0.0f, pixels[i + c])) * 4095.0f + 0.5f)];
+			else if (content == Mip_Content::NORMAL)
+				rgba[i + c] = QuantizeUnit(pixels[i + c] * 0.5f + 0.5f);
+			else
+				rgba[i + c] = QuantizeUnit(pixels[i + c]);
+		}
+		rgba[i + 3] = QuantizeUnit(pixels[i + 3]);
+	}
+}
+
+// the full chain down to 1x1; level 0 is the source itself
+inline void GenerateMipChain(const unsigned char *rgba, int width, int height, Mip_Content content, Mip_Filter filter, std::vector<MipLevel> &levels)
+{
+	levels.clear();
+	levels.push_back(MipLevel());
+	levels[0].width = width;
+	levels[0].height = height;
+	levels[0].rgba.assign(rgba, rgba + (size_t)width * height * 4);
+
+	std::vector<float> current, next;
+	DecodeMipLevel(rgba, (size_t)width * height, content, current);
+	while (width > 1 || height > 1)
+	{
+		DownsampleFloat(current, width, height, filter, next);
+		current.swap(next);
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+		if (content == Mip_Content::NORMAL)
+			RenormalizeNormals(current);
+
+		levels.push_back(MipLevel());
+		levels.back().width = width;
+		levels.back().height = height;
+		EncodeMipLevel(current, content, levels.back().rgba);
+	}
+}
+
+#endif
@@ -1,7 +1,7 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include <glad/glad.h> 
+#include <glad/glad.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -12,43 +12,338 @@
 
 #include "Shader.h"
 #include "Mesh.h"
+#include "GLHandle.h"
+#include "ImportArena.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "RenderQueue.h"
+#include "Renderable.h"
+#include "SceneGraph.h"
+#include "StreamingQueue.h"
+#include "UploadManager.h"
+#include "TextureCompression.h"
+#include "TextureResidency.h"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <utility>
 #include <vector>
 
+// decoded pixels of a texture file, ready to be uploaded
+struct TextureImage {
+	unsigned char *data;
+	int width;
+	int height;
+	int components;
+	std::shared_ptr<TextureChain> chain; // set instead of data when the texture came from the texture cache, mips included
+};
+
+// vertex and index data of one aiMesh, extracted without touching GL
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	unsigned int materialIndex;
+	std::vector<Texture> textures; // material textures by path; only the streaming loader fills it, ids are resolved on upload
+	int node; // its node in the model's hierarchy
+	MeshData() : materialIndex(0), node(0)
+	{ }
+};
+
+// a node of an imported model's hierarchy, as Assimp gave it
+struct ModelNode {
+	int parent;          // index in the same list, before this one, or -1 for the root
+	glm::mat4 transform; // relative to the parent
+};
+
+// progress of a streamed model
+enum class Load_State {
+	LOADING,
+	LOADED,
+	FAILED
+};
+
+// the material textures a mesh uses, in the order it gets them, and their sampler names in the shaders
+const aiTextureType MATERIAL_TEXTURE_TYPES[4] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+const char *const MATERIAL_TEXTURE_NAMES[4] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+
 unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma = false);
+bool DecodeTextureFile(const char *path, const std::string &directory, TextureImage &image);
+unsigned int TextureFromImage(TextureImage &image, const char *path, bool gamma = false);
+unsigned int TextureFromImageStaged(TextureImage &image, const char *path, UploadManager &uploads, const std::function<void(unsigned int)> &done);
+unsigned int PlaceholderTexture(const std::string &typeName);
+void ExtractMeshData(const aiMesh *mesh, MeshData &data);
+
+// a model's texture, which the residency manager may be streaming levels of: it stops before the
+// texture is deleted
+struct ModelTextureTraits {
+	static GLuint create()
+	{
+		return GLTextureTraits::create();
+	}
+	static void destroy(GLuint id)
+	{
+		TextureResidency::get().untrack(id);
+		GLTextureTraits::destroy(id);
+	}
+};
 
-class Model
+// A model owns its meshes and the textures in textures_loaded, and deletes them with itself. It is
+// move-only; a model being streamed in must stay where LoadAsync put it, its pending loads refer to it.
+class Model : public std::enable_shared_from_this<Model>
 {
 public:
 	/*  Model Data */
 	std::vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 	std::vector<Mesh> meshes;
+	std::vector<ModelNode> nodes; // the node hierarchy, parents first; each mesh says which it hangs from
 	std::string directory;
 	bool gammaCorrection;
 
 	/*  Functions   */
 	// constructor, expects a filepath to a 3D model.
-	Model(std::string const &path, bool gamma = false) : gammaCorrection(gamma)
+	// With a job system, texture decoding and mesh processing run on its workers; must be called on its main thread.
+	// Each mesh keeps what retention says of its geometry once uploaded.
+	Model(std::string const &path, bool gamma = false, JobSystem *jobs = NULL, Geometry_Retention retention = Geometry_Retention::DISCARD)
+		: gammaCorrection(gamma), retention(retention), cpuOnly(false), uploads(NULL), usePlaceholders(false), state(Load_State::LOADING),
+		meshesExpected(0), texturesExpected(0), texturesResident(0), residentVersion(0)
 	{
-		loadModel(path);
+		loadModel(path, jobs);
+		state = meshes.empty() ? Load_State::FAILED : Load_State::LOADED;
+		residentVersion = 1;
+	}
+	Model(const Model&) = delete;
+	Model &operator=(const Model&) = delete;
+	Model(Model &&other) = default;
+	Model &operator=(Model &&other) = default;
+
+	// Runs the same import without a GL context: textures are listed but neither decoded nor uploaded, and
+	// the meshes get no buffers (Mesh_Buffers::NONE), so the model can't be drawn. Each mesh keeps what
+	// retention says of its geometry. For tools and benchmarks of the CPU side of loading.
+	static Model ImportGeometry(std::string const &path, Geometry_Retention retention = Geometry_Retention::DISCARD)
+	{
+		Model model;
+		model.retention = retention;
+		model.usePlaceholders = false;
+		model.cpuOnly = true;
+		model.loadModel(path, NULL);
+		model.state = model.meshes.empty() ? Load_State::FAILED : Load_State::LOADED;
+		model.residentVersion = 1;
+		return model;
+	}
+
+	// Starts streaming a model in and returns at once. Import, texture decoding and mesh processing run on the
+	// job system; their GL uploads are posted to the streaming queue, whose update() the GL thread calls every
+	// frame within a time budget. Until then meshes holds only what is resident. With placeholders, a mesh
+	// shows up as soon as its buffers are uploaded and draws with a flat 1x1 texture until its own arrives;
+	// without, it waits for all its textures. With an upload manager, textures and vertex data go through its
+	// staging ring under its per-frame byte budget, and a mesh becomes resident once its buffers are filled.
+	// The services must outlive the load.
+	static std::shared_ptr<Model> LoadAsync(std::string const &path, JobSystem &jobs, StreamingQueue &streaming, UploadManager *uploads = NULL,
+		bool placeholders = true, bool gamma = false, Geometry_Retention retention = Geometry_Retention::DISCARD)
+	{
+		std::shared_ptr<Model> model(new Model());
+		model->directory = path.substr(0, path.find_last_of('/'));
+		model->gammaCorrection = gamma;
+		model->retention = retention;
+		model->uploads = uploads;
+		model->usePlaceholders = placeholders;
+		JobSystem *jobSystem = &jobs;
+		StreamingQueue *queue = &streaming;
+		jobs.run([model, path, jobSystem, queue]() {
+			StreamModel(model, path, *jobSystem, *queue);
+		});
+		return model;
+	}
+
+	// GL thread: drops more of the meshes' CPU geometry, e.g. once a ModelBatch was built from it,
+	// and keeps only that much of the meshes still to come
+	void releaseGeometry(Geometry_Retention retention)
+	{
+		this->retention = retention;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].releaseGeometry(retention);
+	}
+
+	Geometry_Retention getRetention() const
+	{
+		return retention;
+	}
+
+	// bytes of geometry the meshes hold on the CPU
+	size_t getCpuGeometryBytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].getCpuBytes();
+		return bytes;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Model " << directory << ": " << meshes.size() << " meshes, " << getCpuGeometryBytes() / 1024 << " KB of geometry on the CPU ("
+			<< GEOMETRY_RETENTION_NAMES[(int)retention] << " kept)" << std::endl;
+	}
+
+	Load_State getState() const
+	{
+		return state;
+	}
+
+	// changes whenever a mesh becomes resident or a placeholder is replaced; anything built from
+	// meshes (renderables, pointers to their materials) must be rebuilt when it does
+	unsigned int getResidentVersion() const
+	{
+		return residentVersion;
 	}
 
 	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(const Shader &shader)
 	{
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
 
+	// adds the node hierarchy to the scene graph below parent and returns the graph node of the model's
+	// root; the others follow it in the same order. Once known, i.e. not before a streamed model's
+	// counts came in (nodes is empty until then).
+	int AddToSceneGraph(SceneGraph &graph, int parent) const
+	{
+		int first = (int)graph.size();
+		for (unsigned int i = 0; i < nodes.size(); i++)
+			graph.addNode(nodes[i].parent >= 0 ? first + nodes[i].parent : parent, nodes[i].transform);
+		return first;
+	}
+
+	// adds one renderable per mesh to the scene list, placed by the world matrix of its node, whose
+	// hierarchy AddToSceneGraph put in the graph from firstNode on; the shader must outlive the list
+	void AppendRenderables(std::vector<Renderable> &objects, const Shader &shader, const SceneGraph &graph, int firstNode, const Shader *gbufferShader = NULL) const
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			int node = firstNode + meshes[i].node;
+			objects.push_back(makeRenderable(meshes[i].makeDrawItem(shader, graph.getWorld(node)), meshes[i].bounds));
+			objects.back().gbufferShader = gbufferShader;
+			objects.back().node = node;
+		}
+	}
+
+	// the aiMeshes of the scene in the order the model creates its meshes. With nodes, also the node
+	// hierarchy in the same depth-first order, and with meshNodes the index of the node of each mesh.
+	// The lists are vectors of any allocator, an import's usually come from its ImportArena.
+	template <typename MeshList, typename NodeList = std::vector<int> >
+	static void CollectMeshes(const aiNode *node, const aiScene *scene, MeshList &out,
+		std::vector<ModelNode> *nodes = NULL, NodeList *meshNodes = NULL, int parent = -1)
+	{
+		int index = -1;
+		if (nodes)
+		{
+			// aiMatrix4x4 is row-major, glm takes columns
+			const aiMatrix4x4 &m = node->mTransformation;
+			ModelNode entry;
+			entry.parent = parent;
+			entry.transform = glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1), glm::vec4(m.a2, m.b2, m.c2, m.d2),
+				glm::vec4(m.a3, m.b3, m.c3, m.d3), glm::vec4(m.a4, m.b4, m.c4, m.d4));
+			index = (int)nodes->size();
+			nodes->push_back(entry);
+		}
+		for (unsigned int i = 0; i < node->mNumMeshes; i++)
+		{
+			out.push_back(scene->mMeshes[node->mMeshes[i]]);
+			if (meshNodes)
+				meshNodes->push_back(index);
+		}
+		for (unsigned int i = 0; i < node->mNumChildren; i++)
+			CollectMeshes(node->mChildren[i], scene, out, nodes, meshNodes, index);
+	}
+
+	static unsigned int CountMaterialTextures(const aiMaterial *material)
+	{
+		unsigned int count = 0;
+		for (unsigned int t = 0; t < 4; t++)
+			count += material->GetTextureCount(MATERIAL_TEXTURE_TYPES[t]);
+		return count;
+	}
+
+	// the textures of a material in the order processMesh gives them to the mesh, with id 0
+	static void CollectMaterialTextures(const aiMaterial *material, std::vector<Texture> &out)
+	{
+		out.reserve(out.size() + CountMaterialTextures(material));
+		for (unsigned int t = 0; t < 4; t++)
+		{
+			for (unsigned int i = 0; i < material->GetTextureCount(MATERIAL_TEXTURE_TYPES[t]); i++)
+			{
+				aiString str;
+				material->GetTexture(MATERIAL_TEXTURE_TYPES[t], i, &str);
+				Texture texture;
+				texture.id = 0;
+				texture.type = MATERIAL_TEXTURE_NAMES[t];
+				texture.path = str.C_Str();
+				out.push_back(texture);
+			}
+		}
+	}
+
+	// texture paths referenced by the given meshes, each once, in the order the model first uses them
+	// (that of CollectMaterialTextures); read straight from the materials into the lists
+	template <typename MeshList, typename StringList>
+	static void CollectTexturePaths(const MeshList &sceneMeshes, const aiScene *scene, StringList &paths, StringList &typeNames)
+	{
+		for (unsigned int m = 0; m < sceneMeshes.size(); m++)
+		{
+			const aiMaterial *material = scene->mMaterials[sceneMeshes[m]->mMaterialIndex];
+			for (unsigned int t = 0; t < 4; t++)
+			{
+				for (unsigned int i = 0; i < material->GetTextureCount(MATERIAL_TEXTURE_TYPES[t]); i++)
+				{
+					aiString str;
+					material->GetTexture(MATERIAL_TEXTURE_TYPES[t], i, &str);
+					if (std::find(paths.begin(), paths.end(), str.C_Str()) == paths.end())
+					{
+						paths.push_back(str.C_Str());
+						typeNames.push_back(MATERIAL_TEXTURE_NAMES[t]);
+					}
+				}
+			}
+		}
+	}
+
 private:
+	Geometry_Retention retention;
+	bool cpuOnly; // ImportGeometry: no GL objects at all
+	std::vector<GLHandle<ModelTextureTraits> > textureHandles; // own the textures of textures_loaded
+
+	/*  Streaming Data  */
+	// only touched on the GL thread, by tasks of the streaming queue and upload callbacks
+	UploadManager *uploads;
+	bool usePlaceholders;
+	Load_State state;
+	unsigned int meshesExpected;
+	unsigned int texturesExpected;
+	unsigned int texturesResident;
+	unsigned int residentVersion;
+	std::vector<std::shared_ptr<MeshData> > waitingMeshes; // uploaded once their textures are, when placeholders are off
+
+	Model() : gammaCorrection(false), retention(Geometry_Retention::DISCARD), cpuOnly(false), uploads(NULL), usePlaceholders(true), state(Load_State::LOADING),
+		meshesExpected(0), texturesExpected(0), texturesResident(0), residentVersion(0)
+	{ }
+
 	/*  Functions   */
+	// a texture the model owns from now on
+	void addLoadedTexture(const Texture &texture)
+	{
+		textures_loaded.push_back(texture);
+		textureHandles.push_back(GLHandle<ModelTextureTraits>(texture.id));
+	}
+
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(std::string const &path)
+	void loadModel(std::string const &path, JobSystem *jobs)
 	{
 		// read file via ASSIMP
 		Assimp::Importer importer;
@@ -62,114 +357,279 @@ private:
 		// retrieve the directory path of the filepath
 		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		// the import's temporaries come from this thread's arena and are all taken back at the end
+		ImportArena &arena = ImportArena::local();
+		ImportArena::Scope importScope(arena);
+
+		// walk ASSIMP's node tree once to get the meshes in order, and the nodes they hang from
+		ArenaVector<const aiMesh*> sceneMeshes((ArenaAllocator<const aiMesh*>(arena)));
+		ArenaVector<int> meshNodes((ArenaAllocator<int>(arena)));
+		CollectMeshes(scene->mRootNode, scene, sceneMeshes, &nodes, &meshNodes);
+
+		if (jobs)
+			loadTexturesParallel(*jobs, sceneMeshes, scene, arena);
+
+		// only the geometry the meshes take over is on the heap
+		ArenaVector<MeshData> meshData(sceneMeshes.size(), MeshData(), ArenaAllocator<MeshData>(arena));
+		if (jobs)
+		{
+			jobs->parallelFor(sceneMeshes.size(), 1, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+					ExtractMeshData(sceneMeshes[i], meshData[i]);
+			});
+		}
+		else
+		{
+			for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+				ExtractMeshData(sceneMeshes[i], meshData[i]);
+		}
+
+		meshes.reserve(meshes.size() + meshData.size());
+		for (unsigned int i = 0; i < meshData.size(); i++)
+		{
+			meshes.push_back(processMesh(meshData[i], scene));
+			meshes.back().node = meshNodes[i];
+			meshes.back().releaseGeometry(retention);
+		}
 	}
 
-	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	// Decodes every texture the meshes need on the workers; each upload is a main-thread job that
+	// depends on its decode, so uploads start while other images are still decoding.
+	// The textures end up in textures_loaded, where loadMaterialTextures finds them.
+	// Its lists come from arena, the import's.
+	void loadTexturesParallel(JobSystem &jobs, const ArenaVector<const aiMesh*> &sceneMeshes, const aiScene *scene, ImportArena &arena)
 	{
-		// process each mesh located at the current node
-		for (unsigned int i = 0; i < node->mNumMeshes; i++)
+		ArenaVector<std::string> paths((ArenaAllocator<std::string>(arena))), typeNames((ArenaAllocator<std::string>(arena)));
+		CollectTexturePaths(sceneMeshes, scene, paths, typeNames);
+
+		ArenaVector<TextureImage> images(paths.size(), TextureImage(), ArenaAllocator<TextureImage>(arena));
+		ArenaVector<Texture> loaded(paths.size(), Texture(), ArenaAllocator<Texture>(arena));
+		ArenaVector<JobCounter> decoded(paths.size(), ArenaAllocator<JobCounter>(arena));
+		JobCounter uploaded;
+		for (unsigned int i = 0; i < paths.size(); i++)
 		{
-			// the node object only contains indices to index the actual objects in the scene. 
-			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			jobs.run([&, i]() {
+				DecodeTextureFile(paths[i].c_str(), directory, images[i]);
+			}, &decoded[i]);
+			jobs.runOnMainThread([&, i]() {
+				loaded[i].id = TextureFromImage(images[i], paths[i].c_str());
+				loaded[i].type = typeNames[i];
+				loaded[i].path = paths[i];
+			}, &uploaded, &decoded[i]);
 		}
-		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-		for (unsigned int i = 0; i < node->mNumChildren; i++)
+		jobs.wait(uploaded);
+		for (unsigned int i = 0; i < loaded.size(); i++)
+			addLoadedTexture(loaded[i]);
+	}
+
+	// Worker half of LoadAsync: imports the file, then fans out one job per texture decode and one per
+	// mesh. The importer is shared by the mesh jobs and freed with the last of them. Every result is
+	// handed to the GL thread through the streaming queue; since the queue is FIFO, the task announcing
+	// the counts always runs before any upload.
+	static void StreamModel(std::shared_ptr<Model> model, const std::string &path, JobSystem &jobs, StreamingQueue &streaming)
+	{
+		std::shared_ptr<Assimp::Importer> importer(new Assimp::Importer());
+		const aiScene *scene = importer->ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 		{
-			processNode(node->mChildren[i], scene);
+			std::string error = importer->GetErrorString();
+			streaming.post([model, error]() {
+				std::cout << "ERROR::ASSIMP:: " << error << std::endl;
+				model->state = Load_State::FAILED;
+			});
+			return;
 		}
 
+		// the lists only live until the jobs are queued: from this worker's arena
+		ImportArena &arena = ImportArena::local();
+		ImportArena::Scope importScope(arena);
+		ArenaVector<const aiMesh*> sceneMeshes((ArenaAllocator<const aiMesh*>(arena)));
+		std::vector<ModelNode> nodes;
+		ArenaVector<int> meshNodes((ArenaAllocator<int>(arena)));
+		CollectMeshes(scene->mRootNode, scene, sceneMeshes, &nodes, &meshNodes);
+		ArenaVector<std::string> paths((ArenaAllocator<std::string>(arena))), typeNames((ArenaAllocator<std::string>(arena)));
+		CollectTexturePaths(sceneMeshes, scene, paths, typeNames);
+
+		unsigned int meshCount = (unsigned int)sceneMeshes.size();
+		unsigned int textureCount = (unsigned int)paths.size();
+		streaming.post([model, meshCount, textureCount, nodes]() {
+			model->nodes = nodes;
+			model->meshesExpected = meshCount;
+			model->texturesExpected = textureCount;
+			model->updateState();
+		});
+
+		StreamingQueue *queue = &streaming;
+		for (unsigned int i = 0; i < paths.size(); i++)
+		{
+			std::string texturePath = paths[i];
+			std::string typeName = typeNames[i];
+			jobs.run([model, texturePath, typeName, queue]() {
+				TextureImage image;
+				DecodeTextureFile(texturePath.c_str(), model->directory, image);
+				queue->post([model, texturePath, typeName, image]() {
+					TextureImage pixels = image;
+					model->textureStreamed(texturePath, typeName, pixels);
+				});
+			});
+		}
+		for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+		{
+			const aiMesh *mesh = sceneMeshes[i];
+			int node = meshNodes[i];
+			jobs.run([model, importer, scene, mesh, node, queue]() {
+				std::shared_ptr<MeshData> data(new MeshData());
+				ExtractMeshData(mesh, *data);
+				data->node = node;
+				CollectMaterialTextures(scene->mMaterials[data->materialIndex], data->textures);
+				queue->post([model, data]() {
+					model->meshStreamed(data);
+				});
+			});
+		}
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// GL thread: uploads a decoded texture, directly or through the upload manager
+	void textureStreamed(const std::string &path, const std::string &typeName, TextureImage &image)
 	{
-		// data to fill
-		std::vector<Vertex> vertices;
-		std::vector<unsigned int> indices;
-		std::vector<Texture> textures;
+		if (!uploads)
+		{
+			textureResident(path, typeName, TextureFromImage(image, path.c_str(), gammaCorrection));
+			return;
+		}
+		std::shared_ptr<Model> self = shared_from_this();
+		TextureFromImageStaged(image, path.c_str(), *uploads, [self, path, typeName](unsigned int id) {
+			self->textureResident(path, typeName, id);
+		});
+	}
 
-		// Walk through each of the mesh's vertices
-		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-		{
-			Vertex vertex;
-			glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-							  // positions
-			vector.x = mesh->mVertices[i].x;
-			vector.y = mesh->mVertices[i].y;
-			vector.z = mesh->mVertices[i].z;
-			vertex.Position = vector;
-			// normals
-			vector.x = mesh->mNormals[i].x;
-			vector.y = mesh->mNormals[i].y;
-			vector.z = mesh->mNormals[i].z;
-			vertex.Normal = vector;
-			// texture coordinates
-			if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+	// GL thread: a texture is filled; swaps it in for the placeholders that stood in for it
+	void textureResident(const std::string &path, const std::string &typeName, unsigned int id)
+	{
+		Texture texture;
+		texture.id = id;
+		texture.type = typeName;
+		texture.path = path;
+		addLoadedTexture(texture);
+		texturesResident++;
+
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].replaceTexture(path, texture.id);
+		residentVersion++;
+
+		// meshes held back for their textures
+		for (unsigned int i = 0; i < waitingMeshes.size();)
+		{
+			if (uploadMesh(waitingMeshes[i]))
+				waitingMeshes.erase(waitingMeshes.begin() + i);
+			else
+				i++;
+		}
+		updateState();
+	}
+
+	// GL thread: uploads an extracted mesh, or parks it until its textures are resident
+	void meshStreamed(const std::shared_ptr<MeshData> &data)
+	{
+		if (!uploadMesh(data))
+			waitingMeshes.push_back(data);
+		updateState();
+	}
+
+	// resolves the mesh's textures against textures_loaded and creates it; false when a texture is
+	// missing and placeholders are off
+	bool uploadMesh(const std::shared_ptr<MeshData> &data)
+	{
+		for (unsigned int i = 0; i < data->textures.size(); i++)
+		{
+			Texture &texture = data->textures[i];
+			texture.id = 0;
+			for (unsigned int j = 0; j < textures_loaded.size(); j++)
 			{
-				glm::vec2 vec;
-				// a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
-				// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-				vec.x = mesh->mTextureCoords[0][i].x;
-				vec.y = mesh->mTextureCoords[0][i].y;
-				vertex.TexCoords = vec;
+				if (textures_loaded[j].path == texture.path)
+				{
+					texture.id = textures_loaded[j].id;
+					break;
+				}
 			}
-			else
-				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-			// tangent
-			vector.x = mesh->mTangents[i].x;
-			vector.y = mesh->mTangents[i].y;
-			vector.z = mesh->mTangents[i].z;
-			vertex.Tangent = vector;
-			// bitangent
-			vector.x = mesh->mBitangents[i].x;
-			vector.y = mesh->mBitangents[i].y;
-			vector.z = mesh->mBitangents[i].z;
-			vertex.Bitangent = vector;
-			vertices.push_back(vertex);
-		}
-		// now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
-		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
-		{
-			aiFace face = mesh->mFaces[i];
-			// retrieve all indices of the face and store them in the indices vector
-			for (unsigned int j = 0; j < face.mNumIndices; j++)
-				indices.push_back(face.mIndices[j]);
+			if (texture.id == 0)
+			{
+				if (!usePlaceholders)
+					return false;
+				texture.id = PlaceholderTexture(texture.type);
+			}
+		}
+		// the mesh takes the geometry over, data is done with
+		if (!uploads)
+		{
+			meshes.push_back(Mesh(std::move(data->vertices), std::move(data->indices), std::move(data->textures)));
+			meshes.back().node = data->node;
+			meshes.back().releaseGeometry(retention);
+			residentVersion++;
+			return true;
 		}
+
+		// the buffers are allocated now and filled over the next frames; the index buffer is queued
+		// last, so once it is done the whole mesh is. Until then the mesh waits aside, and the bytes
+		// being uploaded are its own vectors.
+		std::shared_ptr<Mesh> pending(new Mesh(std::move(data->vertices), std::move(data->indices), std::move(data->textures), Mesh_Buffers::ALLOCATED));
+		pending->node = data->node;
+		std::shared_ptr<const unsigned char> vertexBytes(pending, (const unsigned char*)pending->vertices.data());
+		std::shared_ptr<const unsigned char> indexBytes(pending, (const unsigned char*)pending->indices.data());
+		uploads->uploadBuffer(pending->getVBO(), 0, pending->vertices.size() * sizeof(Vertex), vertexBytes, std::function<void()>());
+		std::shared_ptr<Model> self = shared_from_this();
+		uploads->uploadBuffer(pending->getEBO(), 0, pending->indices.size() * sizeof(unsigned int), indexBytes, [self, pending]() {
+			self->meshes.push_back(std::move(*pending));
+			// textures that became resident while the buffers were in flight
+			Mesh &resident = self->meshes.back();
+			resident.releaseGeometry(self->retention);
+			for (unsigned int i = 0; i < resident.textures.size(); i++)
+				for (unsigned int j = 0; j < self->textures_loaded.size(); j++)
+					if (self->textures_loaded[j].path == resident.textures[i].path)
+						resident.replaceTexture(resident.textures[i].path, self->textures_loaded[j].id);
+			self->residentVersion++;
+			self->updateState();
+		});
+		return true;
+	}
+
+	void updateState()
+	{
+		if (state == Load_State::LOADING && meshes.size() == meshesExpected && texturesResident == texturesExpected)
+		{
+			state = Load_State::LOADED;
+			std::cout << "Model streamed in: " << directory << ", " << meshes.size() << " meshes, " << texturesResident << " textures" << std::endl;
+		}
+	}
+
+	// takes the geometry over from data
+	Mesh processMesh(MeshData &data, const aiScene *scene)
+	{
+		// data to fill, sized for all of them at once
+		aiMaterial* material = scene->mMaterials[data.materialIndex];
+		std::vector<Texture> textures;
+		textures.reserve(CountMaterialTextures(material));
+
 		// process materials
-		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 		// we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-		// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
+		// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
 		// Same applies to other texture as the following list summarizes:
 		// diffuse: texture_diffuseN
 		// specular: texture_specularN
 		// normal: texture_normalN
-
-		// 1. diffuse maps
-		std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-		// 2. specular maps
-		std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+		// height: texture_heightN
+		// in that order (MATERIAL_TEXTURE_TYPES), appended straight to the mesh's list
+		for (unsigned int t = 0; t < 4; t++)
+			loadMaterialTextures(material, MATERIAL_TEXTURE_TYPES[t], MATERIAL_TEXTURE_NAMES[t], textures);
 
 		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		return Mesh(std::move(data.vertices), std::move(data.indices), std::move(textures), cpuOnly ? Mesh_Buffers::NONE : Mesh_Buffers::FILLED);
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
+	// the required info is appended to textures as Texture structs.
+	void loadMaterialTextures(aiMaterial *mat, aiTextureType type, const char *typeName, std::vector<Texture> &textures)
 	{
-		std::vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
@@ -188,40 +648,79 @@ private:
 			if (!skip)
 			{   // if texture hasn't been loaded already, load it
 				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
+				texture.id = cpuOnly ? 0 : TextureFromFile(str.C_Str(), this->directory);
 				texture.type = typeName;
 				texture.path = str.C_Str();
 				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+				addLoadedTexture(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
 			}
 		}
-		return textures;
 	}
 };
 
 
 unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma)
 {
+	TextureImage image;
+	DecodeTextureFile(path, directory, image);
+	return TextureFromImage(image, path, gamma);
+}
+
+// CPU half of TextureFromFile, safe to call from any thread. Once DetectTextureCompression has run the
+// texture comes back as a complete mip chain from the texture cache (built now if needed), block-compressed
+// when the context supports its format.
+bool DecodeTextureFile(const char *path, const std::string &directory, TextureImage &image)
+{
+	image.data = NULL;
+	image.chain.reset();
+	std::shared_ptr<TextureChain> chain(new TextureChain());
+	if (LoadTextureChain(path, directory, *chain))
+	{
+		image.chain = chain;
+		image.width = chain->width;
+		image.height = chain->height;
+		image.components = chain->sourceComponents;
+		return true;
+	}
+
 	std::string filename = std::string(path);
 	filename = directory + '/' + filename;
 
+	image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0);
+	return image.data != NULL;
+}
+
+GLenum ImageFormat(int components)
+{
+	if (components == 1)
+		return GL_RED;
+	else if (components == 2)
+		return GL_RG;
+	else if (components == 3)
+		return GL_RGB;
+	return GL_RGBA;
+}
+
+// GL half of TextureFromFile: uploads and frees the decoded pixels
+unsigned int TextureFromImage(TextureImage &image, const char *path, bool gamma)
+{
+	if (image.chain)
+	{
+		unsigned int textureID = TextureFromChain(*image.chain, path);
+		TextureResidency::get().track(textureID, *image.chain);
+		image.chain.reset();
+		return textureID;
+	}
+
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
+	if (image.data)
 	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
+		GLenum format = ImageFormat(image.components);
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -229,15 +728,154 @@ unsigned int TextureFromFile(const char *path, const std::string &directory, boo
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-		stbi_image_free(data);
+		stbi_image_free(image.data);
+		image.data = NULL;
 	}
 	else
 	{
 		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
 	}
 
 	return textureID;
 }
 
+// TextureFromImage through the upload manager: the pixels are handed over (and freed once staged) and
+// done receives the texture after its last band and mipmaps are issued. Failed decodes complete at once.
+unsigned int TextureFromImageStaged(TextureImage &image, const char *path, UploadManager &uploads, const std::function<void(unsigned int)> &done)
+{
+	if (image.chain)
+	{
+		// one upload per level, each from its own data; done follows the last
+		std::shared_ptr<TextureChain> chain = image.chain;
+		image.chain.reset();
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)chain->levels.size() - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		for (unsigned int i = 0; i < chain->levels.size(); i++)
+		{
+			const TextureLevel &level = chain->levels[i];
+			std::shared_ptr<const unsigned char> data(chain, &level.data[0]);
+			std::function<void()> levelDone;
+			if (i + 1 == chain->levels.size())
+				levelDone = [done, textureID, chain]() {
+					TextureResidency::get().track(textureID, *chain);
+					done(textureID);
+				};
+			if (chain->internalFormat == GL_RGBA8)
+				uploads.uploadTexture(textureID, i, GL_RGBA8, level.width, level.height, GL_RGBA, GL_UNSIGNED_BYTE, 4, data, false, levelDone);
+			else
+				uploads.uploadCompressedTexture(textureID, i, chain->internalFormat, level.width, level.height, level.data.size(), data, levelDone);
+		}
+		ReportTextureCompression(path, *chain);
+		return textureID;
+	}
+
+	if (!image.data)
+	{
+		unsigned int textureID = TextureFromImage(image, path);
+		done(textureID);
+		return textureID;
+	}
+
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	GLStateCache::get().bindTexture(GL_TEXTURE_2D, textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	GLenum format = ImageFormat(image.components);
+	std::shared_ptr<const unsigned char> pixels(image.data, stbi_image_free);
+	image.data = NULL;
+	uploads.uploadTexture(textureID, 0, format, image.width, image.height, format, GL_UNSIGNED_BYTE, image.components, pixels, true, [done, textureID]() {
+		done(textureID);
+	});
+	return textureID;
+}
+
+// 1x1 stand-in used while a streamed texture is on its way: mid grey, or a flat normal for normal maps
+unsigned int PlaceholderTexture(const std::string &typeName)
+{
+	static unsigned int grey = 0, flatNormal = 0;
+	bool normal = typeName == "texture_normal";
+	unsigned int &textureID = normal ? flatNormal : grey;
+	if (textureID == 0)
+	{
+		const unsigned char greyPixel[4] = { 128, 128, 128, 255 };
+		const unsigned char normalPixel[4] = { 128, 128, 255, 255 };
+		glGenTextures(1, &textureID);
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, normal ? normalPixel : greyPixel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	return textureID;
+}
+
+void ExtractMeshData(const aiMesh *mesh, MeshData &data)
+{
+	data.materialIndex = mesh->mMaterialIndex;
+
+	// sized exactly up front: one allocation each instead of a reallocation every time they grow
+	unsigned int indexCount = 0;
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		indexCount += mesh->mFaces[i].mNumIndices;
+	data.vertices.reserve(data.vertices.size() + mesh->mNumVertices);
+	data.indices.reserve(data.indices.size() + indexCount);
+
+	// Walk through each of the mesh's vertices
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		Vertex vertex;
+		glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
+						  // positions
+		vector.x = mesh->mVertices[i].x;
+		vector.y = mesh->mVertices[i].y;
+		vector.z = mesh->mVertices[i].z;
+		vertex.Position = vector;
+		// normals
+		vector.x = mesh->mNormals[i].x;
+		vector.y = mesh->mNormals[i].y;
+		vector.z = mesh->mNormals[i].z;
+		vertex.Normal = vector;
+		// texture coordinates
+		if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+		{
+			glm::vec2 vec;
+			// a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
+			// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
+			vec.x = mesh->mTextureCoords[0][i].x;
+			vec.y = mesh->mTextureCoords[0][i].y;
+			vertex.TexCoords = vec;
+		}
+		else
+			vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+		// tangent
+		vector.x = mesh->mTangents[i].x;
+		vector.y = mesh->mTangents[i].y;
+		vector.z = mesh->mTangents[i].z;
+		vertex.Tangent = vector;
+		// bitangent
+		vector.x = mesh->mBitangents[i].x;
+		vector.y = mesh->mBitangents[i].y;
+		vector.z = mesh->mBitangents[i].z;
+		vertex.Bitangent = vector;
+		data.vertices.push_back(vertex);
+	}
+	// now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		const aiFace &face = mesh->mFaces[i];
+		// retrieve all indices of the face and store them in the indices vector
+		for (unsigned int j = 0; j < face.mNumIndices; j++)
+			data.indices.push_back(face.mIndices[j]);
+	}
+}
+
 #endif
@@ -0,0 +1,305 @@
+#ifndef MODEL_BATCH_H
+#define MODEL_BATCH_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "GLHandle.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Renderable.h"
+#include "SceneGraph.h"
+#include "Shader.h"
+#include "TextureArrays.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A model redrawn so that meshes with different materials can share one draw call:
+// - every mesh's vertices and indices go into one vertex and index buffer, meshes keep their
+//   index range and base vertex,
+// - diffuse and specular maps are packed into texture arrays (TextureArrays),
+// - each vertex carries the index of its mesh's material (attribute 5), which the shader looks up
+//   in the materialLayers table to find its layers.
+// Meshes whose maps live in the same pair of arrays share a Material, so their draws sort next to
+// each other and the render queue merges them into one glMultiDrawElementsBaseVertex. Culling
+// stays per mesh. Drawn with batch.vs/batch.fs.
+class ModelBatch {
+public:
+	// size of the materialLayers table in batch.vs
+	static const unsigned int MAX_MATERIALS = 64;
+
+	ModelBatch()
+	{ }
+	ModelBatch(const ModelBatch&) = delete;
+	ModelBatch &operator=(const ModelBatch&) = delete;
+
+	bool isBuilt() const
+	{
+		return VAO.get() != 0;
+	}
+
+	// GL thread, once every mesh of model is resident. The maps are decoded again (from the texture
+	// cache when it is on) in parallel on jobs, the geometry is copied from the meshes, so the model
+	// must have been loaded with Geometry_Retention::ALL. False if it wasn't, or if the model has more
+	// than MAX_MATERIALS materials.
+	bool build(const Model &model, JobSystem &jobs)
+	{
+		if (model.getRetention() != Geometry_Retention::ALL)
+		{
+			std::cout << "ERROR::MODEL_BATCH:: the model's vertices were released after upload, load it with Geometry_Retention::ALL" << std::endl;
+			return false;
+		}
+		// distinct materials, by the maps the batch shader uses
+		std::vector<unsigned int> meshMaterial(model.meshes.size());
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
+		{
+			BatchMaterial material;
+			material.diffuse = firstTexture(model.meshes[i], "texture_diffuse");
+			material.specular = firstTexture(model.meshes[i], "texture_specular");
+			unsigned int found = 0;
+			while (found < materials.size() && !(materials[found].diffuse == material.diffuse && materials[found].specular == material.specular))
+				found++;
+			if (found == materials.size())
+				materials.push_back(material);
+			meshMaterial[i] = found;
+		}
+		if (materials.size() > MAX_MATERIALS)
+		{
+			std::cout << "ERROR::BATCH:: " << materials.size() << " materials, at most " << MAX_MATERIALS << " can be batched" << std::endl;
+			materials.clear();
+			return false;
+		}
+
+		// decode each map once
+		std::vector<std::string> paths;
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			const std::string *maps[2] = { &materials[i].diffuse, &materials[i].specular };
+			for (unsigned int m = 0; m < 2; m++)
+				if (!maps[m]->empty() && std::find(paths.begin(), paths.end(), *maps[m]) == paths.end())
+					paths.push_back(*maps[m]);
+		}
+		std::vector<std::shared_ptr<TextureChain> > chains(paths.size());
+		std::vector<char> decoded(paths.size(), 0);
+		const std::string &directory = model.directory;
+		jobs.parallelFor(paths.size(), 1, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				chains[i].reset(new TextureChain());
+				decoded[i] = LoadBatchTexture(paths[i], directory, *chains[i]) ? 1 : 0;
+			}
+		});
+		std::vector<TextureArrays::Slot> slots(paths.size());
+		for (unsigned int i = 0; i < paths.size(); i++)
+		{
+			if (decoded[i])
+				slots[i] = arrays.add(chains[i]);
+			else
+			{
+				std::cout << "Texture failed to load at path: " << paths[i] << std::endl;
+				slots[i] = TextureArrays::none();
+			}
+		}
+		chains.clear();
+		arrays.upload();
+
+		// layers for the shader, and one Material per pair of arrays
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			TextureArrays::Slot diffuse = slotOf(paths, slots, materials[i].diffuse);
+			TextureArrays::Slot specular = slotOf(paths, slots, materials[i].specular);
+			materials[i].diffuseLayer = diffuse.layer;
+			materials[i].specularLayer = specular.layer;
+			unsigned int group = 0;
+			while (group < groups.size() && !(groups[group].diffuseArray == diffuse.array && groups[group].specularArray == specular.array))
+				group++;
+			if (group == groups.size())
+			{
+				Group created;
+				created.diffuseArray = diffuse.array;
+				created.specularArray = specular.array;
+				created.material.reset(new Material());
+				created.material->addTexture("diffuseArray", diffuse.array >= 0 ? arrays.getTexture(diffuse.array) : 0, GL_TEXTURE_2D_ARRAY);
+				created.material->addTexture("specularArray", specular.array >= 0 ? arrays.getTexture(specular.array) : 0, GL_TEXTURE_2D_ARRAY);
+				groups.push_back(std::move(created));
+			}
+			materials[i].group = group;
+		}
+
+		// one vertex and index buffer for all meshes
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		std::vector<GLushort> materialIndices;
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
+		{
+			const Mesh &mesh = model.meshes[i];
+			Part part;
+			part.first = (GLint)indices.size();
+			part.count = (GLsizei)mesh.indices.size();
+			part.baseVertex = (GLint)vertices.size();
+			part.group = materials[meshMaterial[i]].group;
+			part.bounds = mesh.bounds;
+			part.node = mesh.node;
+			parts.push_back(part);
+			vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+			indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+			materialIndices.insert(materialIndices.end(), mesh.vertices.size(), (GLushort)meshMaterial[i]);
+		}
+		if (vertices.empty() || indices.empty())
+		{
+			parts.clear();
+			return false;
+		}
+		setupBuffers(vertices, indices, materialIndices);
+		return true;
+	}
+
+	// GL thread: fills the shader's materialLayers table; it stays in the program
+	void setupShader(const Shader &shader) const
+	{
+		std::vector<GLint> table;
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			table.push_back(materials[i].diffuseLayer);
+			table.push_back(materials[i].specularLayer);
+			table.push_back(0);
+			table.push_back(0);
+		}
+		GLStateCache::get().useProgram(shader.getProgramID());
+		if (!table.empty())
+			glUniform4iv(glGetUniformLocation(shader.getProgramID(), "materialLayers"), (GLsizei)materials.size(), &table[0]);
+	}
+
+	// a renderable per mesh, drawn with shader (batch.vs/batch.fs), and with gbufferShader
+	// (batch.vs/gbuffer_batch.fs) in the G-buffer pass; placed like Model::AppendRenderables does
+	void AppendRenderables(std::vector<Renderable> &objects, const Shader &shader, const SceneGraph &graph, int firstNode, const Shader *gbufferShader = NULL) const
+	{
+		for (unsigned int i = 0; i < parts.size(); i++)
+		{
+			DrawItem item;
+			item.shader = &shader;
+			item.material = groups[parts[i].group].material.get();
+			item.vao = VAO.get();
+			item.mode = GL_TRIANGLES;
+			item.first = parts[i].first;
+			item.count = parts[i].count;
+			item.baseVertex = parts[i].baseVertex;
+			item.indexed = true;
+			item.model = graph.getWorld(firstNode + parts[i].node);
+			item.layerMask = 0;
+			objects.push_back(makeRenderable(item, parts[i].bounds));
+			objects.back().gbufferShader = gbufferShader;
+			objects.back().node = firstNode + parts[i].node;
+		}
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Batch: " << parts.size() << " meshes, " << materials.size() << " materials in " << groups.size()
+			<< " texture array sets (at most " << groups.size() << " draw calls per pass)" << std::endl;
+		arrays.printStats(out);
+	}
+
+private:
+	struct BatchMaterial {
+		std::string diffuse, specular; // paths relative to the model, empty if the mesh has none
+		int diffuseLayer, specularLayer; // -1 when missing
+		unsigned int group;
+	};
+
+	// meshes sharing the same diffuse and specular array
+	struct Group {
+		int diffuseArray, specularArray;
+		std::unique_ptr<Material> material; // renderables point at it
+	};
+
+	struct Part {
+		GLint first;
+		GLsizei count;
+		GLint baseVertex;
+		unsigned int group;
+		AABB bounds;
+		int node; // of the mesh, in the model's hierarchy
+	};
+
+	GLVertexArray VAO;
+	GLBuffer VBO, EBO, materialVBO;
+	TextureArrays arrays;
+	std::vector<BatchMaterial> materials;
+	std::vector<Group> groups;
+	std::vector<Part> parts;
+
+	static std::string firstTexture(const Mesh &mesh, const std::string &type)
+	{
+		for (unsigned int i = 0; i < mesh.textures.size(); i++)
+			if (mesh.textures[i].type == type)
+				return mesh.textures[i].path;
+		return std::string();
+	}
+
+	static TextureArrays::Slot slotOf(const std::vector<std::string> &paths, const std::vector<TextureArrays::Slot> &slots, const std::string &path)
+	{
+		for (unsigned int i = 0; i < paths.size(); i++)
+			if (paths[i] == path)
+				return slots[i];
+		return TextureArrays::none();
+	}
+
+	// any thread: the map's mip chain, from the texture cache or built uncompressed when it is off
+	static bool LoadBatchTexture(const std::string &path, const std::string &directory, TextureChain &chain)
+	{
+		if (LoadTextureChain(path.c_str(), directory, chain))
+			return true;
+		int width, height, components;
+		unsigned char *rgba = stbi_load((directory + '/' + path).c_str(), &width, &height, &components, 4);
+		if (!rgba)
+			return false;
+		chain.sourceComponents = components;
+		BuildTextureChain(rgba, width, height, GL_RGBA8, MipContentForPath(path), (Mip_Filter)TextureMipFilter().load(), chain);
+		stbi_image_free(rgba);
+		return true;
+	}
+
+	void setupBuffers(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, const std::vector<GLushort> &materialIndices)
+	{
+		VAO = GLVertexArray::create();
+		VBO = GLBuffer::create();
+		EBO = GLBuffer::create();
+		materialVBO = GLBuffer::create();
+
+		GLStateCache::get().bindVertexArray(VAO.get());
+		glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+
+		// same layout as Mesh
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		// material index, an integer attribute
+		glBindBuffer(GL_ARRAY_BUFFER, materialVBO.get());
+		glBufferData(GL_ARRAY_BUFFER, materialIndices.size() * sizeof(GLushort), &materialIndices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(5);
+		glVertexAttribIPointer(5, 1, GL_UNSIGNED_SHORT, sizeof(GLushort), (void*)0);
+
+		GLStateCache::get().bindVertexArray(0);
+	}
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef MOMENT_SHADOW_MAP_H
+#define MOMENT_SHADOW_MAP_H
+
+#include <glad/glad.h>
+
+#include "GLHandle.h"
+#include "GLState.h"
+#include "Shader.h"
+
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+// Exponential variance shadow map (EVSM) of the lamp's cube, for --evsm. Instead of depth, the cube
+// pass writes the moments exp(c d) and exp(2 c d) (shadow_moments.fs) into the six layers of a
+// size x size array. filter() blurs each face separably into a cube map and builds its mipmaps,
+// so the lookup in shadow_mapping.glsl is one trilinear fetch where PCF needs four to nine, and the
+// blur and mipmaps give soft, alias-free edges at any distance.
+// The faces are blurred one by one, so the blur doesn't cross cube edges; seamless cube filtering
+// hides most of that. GL thread only.
+class MomentShadowMap {
+public:
+	MomentShadowMap() : size(0)
+	{ }
+	MomentShadowMap(const MomentShadowMap&) = delete;
+	MomentShadowMap &operator=(const MomentShadowMap&) = delete;
+
+	// creates the targets for size x size faces, once; false if the driver rejects them
+	bool create(int size)
+	{
+		this->size = size;
+		GLStateCache &state = GLStateCache::get();
+		moments = createArray(GL_RG32F, GL_RG, GL_FLOAT, 6);
+		depth = createArray(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 6);
+		blurred = createArray(GL_RG32F, GL_RG, GL_FLOAT, 1);
+
+		cube = GLTexture::create();
+		state.bindTexture(GL_TEXTURE_CUBE_MAP, cube.get());
+		int levels = 1 + (int)std::floor(std::log2((double)size));
+		for (int level = 0, levelSize = size; level < levels; level++, levelSize = levelSize > 1 ? levelSize / 2 : 1)
+			for (GLuint face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RG32F, levelSize, levelSize, 0, GL_RG, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		// layered: the cube pass picks the face with gl_Layer
+		depthFBO = GLFramebuffer::create();
+		glBindFramebuffer(GL_FRAMEBUFFER, depthFBO.get());
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, moments.get(), 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth.get(), 0);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		blurFBO = GLFramebuffer::create();
+		glBindFramebuffer(GL_FRAMEBUFFER, blurFBO.get());
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, blurred.get(), 0, 0);
+		complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		// the face is attached by filter()
+		cubeFBO = GLFramebuffer::create();
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+		{
+			std::cout << "ERROR::SHADOW:: moment shadow map framebuffer is not complete" << std::endl;
+			return false;
+		}
+
+		// the blur draws a triangle made up from gl_VertexID, but core profile still wants a VAO
+		emptyVAO = GLVertexArray::create();
+		return true;
+	}
+
+	// the cube pass renders into the faces after this, until the caller binds another framebuffer;
+	// exponent is the c of the moments
+	void beginDepth(float exponent)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, depthFBO.get());
+		glViewport(0, 0, size, size);
+		// where nothing is drawn the moments are those of the far plane
+		GLfloat farMoments[4] = { std::exp(exponent), std::exp(2.0f * exponent), 0.0f, 0.0f };
+		glClearBufferfv(GL_COLOR, 0, farMoments);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+
+	// blurs every face into the cube map with blurShader (fullscreen.vs/shadow_moments_blur.fs) and
+	// rebuilds the mipmaps
+	void filter(const Shader &blurShader)
+	{
+		GLStateCache &state = GLStateCache::get();
+		state.useProgram(blurShader.getProgramID());
+		blurShader.setInt("source", 0);
+		state.bindVertexArray(emptyVAO.get());
+		glViewport(0, 0, size, size);
+		glDisable(GL_DEPTH_TEST);
+		for (GLuint face = 0; face < 6; face++)
+		{
+			// horizontally from the face's layer into the scratch layer
+			glBindFramebuffer(GL_FRAMEBUFFER, blurFBO.get());
+			state.bindTextureUnit(0, GL_TEXTURE_2D_ARRAY, moments.get());
+			blurShader.setInt("layer", (int)face);
+			blurShader.setBool("horizontal", true);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			// vertically from there into the cube face
+			glBindFramebuffer(GL_FRAMEBUFFER, cubeFBO.get());
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cube.get(), 0);
+			state.bindTextureUnit(0, GL_TEXTURE_2D_ARRAY, blurred.get());
+			blurShader.setInt("layer", 0);
+			blurShader.setBool("horizontal", false);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+		glEnable(GL_DEPTH_TEST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		state.bindTexture(GL_TEXTURE_CUBE_MAP, cube.get());
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	}
+
+	// the filtered moments, a mipmapped RG32F cube map
+	GLuint getTexture() const
+	{
+		return cube.get();
+	}
+
+	size_t getMemoryBytes() const
+	{
+		size_t face = (size_t)size * size;
+		// moments and depth layers, the scratch layer, and the cube with its mipmaps (about 4/3)
+		return face * 6 * 8 + face * 6 * 4 + face * 8 + face * 6 * 8 * 4 / 3;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Moment shadow map: " << size << "x" << size << " faces, RG32F moments, " << getMemoryBytes() / 1024 << " KB" << std::endl;
+	}
+
+private:
+	int size;
+	GLFramebuffer depthFBO, blurFBO, cubeFBO;
+	GLTexture moments, depth, blurred, cube;
+	GLVertexArray emptyVAO;
+
+	GLTexture createArray(GLenum internalFormat, GLenum format, GLenum type, GLsizei layers)
+	{
+		GLTexture texture = GLTexture::create();
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D_ARRAY, texture.get());
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, size, size, layers, 0, format, type, NULL);
+		// the blur reads between texels
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+};
+
+#endif
@@ -6,10 +6,31 @@
 #define SCENE_SPACE 1
 #define OBJECT      0
 
+// whether a solid box collides with another box: by overlapping it, or, if the other is a scene
+// space the box has to stay in, by leaving it
+inline bool BoxesCollide(const AABB &box, const AABB &another, bool anotherIsSceneSpace)
+{
+	if (!anotherIsSceneSpace)
+		return box.isOverlap(another);
+	else
+		return !another.isContain(box);
+}
+
+// Whether an object is a scene space is plain data rather than a virtual call, so collision
+// queries over many objects (EntityStore::findCollisions) don't dispatch per object.
 class Object {
 
 public:
-	virtual bool isSceneSpace() const = 0;
+	Object(bool is_scene_space = false) : is_scene_space_(is_scene_space)
+	{ }
+
+	bool isSceneSpace() const
+	{
+		return is_scene_space_;
+	}
+
+protected:
+	bool is_scene_space_;
 };
 
 #endif
@@ -0,0 +1,319 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "JobSystem.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_CULLER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// CPU occlusion culling. A few large occluders (the room's walls) are rasterized in software into a
+// small depth buffer, a pyramid of its farthest depths is built, and each object's bounding box is
+// tested against it before it is recorded: a box whose nearest point lies behind the farthest
+// occluder depth over its whole screen rectangle cannot be seen.
+// - the depth buffer is WIDTH x HEIGHT whatever the window, split into TILE_SIZE tiles;
+// - render() sets the triangles up on the calling thread, clipped against the near plane and a
+//   guard band, bins them into the tiles they overlap and rasterizes the tiles in parallel, four
+//   pixels at a time (SSE2 where available);
+// - isVisible() is const and may be called from any thread once render() returned.
+// Depth is window depth z/w in [0, 1] as GL computes it, so it interpolates linearly on screen.
+// No GL calls: it works, and is benchmarked (--bench-occlusion), without a context.
+class OcclusionCuller {
+public:
+	static const int WIDTH = 256, HEIGHT = 192;
+	static const int TILE_SIZE = 32;
+	static const int TILES_X = WIDTH / TILE_SIZE, TILES_Y = HEIGHT / TILE_SIZE;
+	static const int LEVELS = 7; // 256x192 down to 4x3
+
+	OcclusionCuller() : tested(0), occluded(0), renderTime(0.0)
+	{
+		for (int level = 0; level < LEVELS; level++)
+			pyramid[level].assign((size_t)(WIDTH >> level) * (HEIGHT >> level), 1.0f);
+		bins.resize(TILES_X * TILES_Y);
+	}
+	OcclusionCuller(const OcclusionCuller&) = delete;
+	OcclusionCuller &operator=(const OcclusionCuller&) = delete;
+
+	void clearOccluders()
+	{
+		occluderVertices.clear();
+	}
+	// a triangle list in model space: vertexCount positions, each the first three floats of stride floats
+	void addOccluder(const float *positions, size_t vertexCount, size_t stride, const glm::mat4 &model)
+	{
+		for (size_t i = 0; i + 2 < vertexCount; i += 3)
+			for (size_t k = 0; k < 3; k++)
+			{
+				const float *p = positions + (i + k) * stride;
+				occluderVertices.push_back(glm::vec3(model * glm::vec4(p[0], p[1], p[2], 1.0f)));
+			}
+	}
+
+	// draws the occluders as seen through viewProjection and builds the pyramid; resets the counters
+	void render(JobSystem &jobs, const glm::mat4 &viewProjection)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		this->viewProjection = viewProjection;
+		tested = 0;
+		occluded = 0;
+
+		triangles.clear();
+		for (size_t i = 0; i < bins.size(); i++)
+			bins[i].clear();
+		for (size_t i = 0; i + 2 < occluderVertices.size(); i += 3)
+			setupTriangle(&occluderVertices[i]);
+
+		jobs.parallelFor(bins.size(), 1, [this](size_t begin, size_t end) {
+			for (size_t tile = begin; tile < end; tile++)
+				rasterizeTile((int)tile);
+		});
+		for (int level = 1; level < LEVELS; level++)
+			downsample(level);
+		renderTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// conservative: false only when the box is certainly hidden behind the occluders
+	bool isVisible(const AABB &worldBounds) const
+	{
+		tested.fetch_add(1, std::memory_order_relaxed);
+		glm::vec3 low = worldBounds.getMin(), high = worldBounds.getMax();
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1e30f;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec4 clip = viewProjection * glm::vec4((corner & 1) ? high.x : low.x, (corner & 2) ? high.y : low.y, (corner & 4) ? high.z : low.z, 1.0f);
+			// a corner at or behind the eye: the box can't be bounded on screen
+			if (clip.w <= 1e-5f)
+				return true;
+			float inv = 1.0f / clip.w;
+			minX = std::min(minX, clip.x * inv); maxX = std::max(maxX, clip.x * inv);
+			minY = std::min(minY, clip.y * inv); maxY = std::max(maxY, clip.y * inv);
+			minZ = std::min(minZ, clip.z * inv);
+		}
+		// off screen: the frustum test decides
+		if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+			return true;
+		minZ = minZ * 0.5f + 0.5f;
+		int x0 = toPixel(minX, WIDTH), x1 = toPixel(maxX, WIDTH);
+		int y0 = toPixel(minY, HEIGHT), y1 = toPixel(maxY, HEIGHT);
+		// the finest level where the rectangle spans at most 4x4 texels
+		int level = 0;
+		while (level < LEVELS - 1 && ((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4))
+			level++;
+		int width = WIDTH >> level;
+		const std::vector<float> &depths = pyramid[level];
+		for (int y = y0 >> level; y <= y1 >> level; y++)
+			for (int x = x0 >> level; x <= x1 >> level; x++)
+				if (minZ <= depths[(size_t)y * width + x])
+					return true;
+		occluded.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// boxes tested and found hidden since the last render()
+	size_t getTestedCount() const
+	{
+		return tested.load(std::memory_order_relaxed);
+	}
+	size_t getOccludedCount() const
+	{
+		return occluded.load(std::memory_order_relaxed);
+	}
+	// triangles the last render() rasterized, after clipping
+	size_t getTriangleCount() const
+	{
+		return triangles.size();
+	}
+	double getRenderMilliseconds() const
+	{
+		return renderTime;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Occlusion: " << getOccludedCount() << " of " << getTestedCount() << " tested objects occluded; "
+			<< getTriangleCount() << " occluder triangles rasterized at " << WIDTH << "x" << HEIGHT << " in " << renderTime << " ms" << std::endl;
+	}
+
+private:
+	// a triangle in pixels, counter-clockwise: edge i is inside where A x + B y + C >= 0
+	struct ScreenTriangle {
+		float A[3], B[3], C[3];
+		float zA, zB, zC; // z = zA x + zB y + zC
+		int minX, maxX, minY, maxY;
+	};
+
+	std::vector<glm::vec3> occluderVertices; // world space, three per triangle
+	glm::mat4 viewProjection;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<std::vector<uint32_t> > bins; // per tile, the triangles overlapping it
+	std::vector<float> pyramid[LEVELS];       // level 0 is the depth buffer, then the max of each 2x2
+	mutable std::atomic<size_t> tested, occluded;
+	double renderTime;
+
+	static int toPixel(float ndc, int size)
+	{
+		int pixel = (int)std::floor((ndc * 0.5f + 0.5f) * size);
+		return std::min(std::max(pixel, 0), size - 1);
+	}
+
+	// keeps the part of polygon in[0, count) where plane . v >= 0
+	static int clipPolygon(const glm::vec4 *in, int count, const glm::vec4 &plane, glm::vec4 *out)
+	{
+		int n = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const glm::vec4 &a = in[i], &b = in[(i + 1) % count];
+			float da = glm::dot(plane, a), db = glm::dot(plane, b);
+			if (da >= 0.0f)
+				out[n++] = a;
+			if ((da >= 0.0f) != (db >= 0.0f))
+				out[n++] = a + (b - a) * (da / (da - db));
+		}
+		return n;
+	}
+
+	void setupTriangle(const glm::vec3 *world)
+	{
+		// the near plane, then a guard band twice the screen wide so screen coordinates stay small
+		const float GUARD = 2.0f;
+		static const glm::vec4 planes[5] = { glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+			glm::vec4(1.0f, 0.0f, 0.0f, GUARD), glm::vec4(-1.0f, 0.0f, 0.0f, GUARD), glm::vec4(0.0f, 1.0f, 0.0f, GUARD), glm::vec4(0.0f, -1.0f, 0.0f, GUARD) };
+		glm::vec4 polygon[2][10];
+		int count = 3;
+		for (int k = 0; k < 3; k++)
+			polygon[0][k] = viewProjection * glm::vec4(world[k], 1.0f);
+		int current = 0;
+		for (int p = 0; p < 5 && count >= 3; p++)
+		{
+			count = clipPolygon(polygon[current], count, planes[p], polygon[1 - current]);
+			current = 1 - current;
+		}
+
+		glm::vec3 screen[10];
+		for (int k = 0; k < count; k++)
+		{
+			const glm::vec4 &v = polygon[current][k];
+			float inv = 1.0f / v.w;
+			screen[k] = glm::vec3((v.x * inv * 0.5f + 0.5f) * WIDTH, (v.y * inv * 0.5f + 0.5f) * HEIGHT, v.z * inv * 0.5f + 0.5f);
+		}
+		for (int k = 1; k + 1 < count; k++)
+			addScreenTriangle(screen[0], screen[k], screen[k + 1]);
+	}
+
+	void addScreenTriangle(const glm::vec3 &a, glm::vec3 b, glm::vec3 c)
+	{
+		float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (std::abs(area) < 1e-6f)
+			return;
+		// occluders are drawn from both sides
+		if (area < 0.0f)
+		{
+			std::swap(b, c);
+			area = -area;
+		}
+
+		ScreenTriangle t;
+		// pixels whose centre lies inside the bounds
+		t.minX = std::max((int)std::ceil(std::min(a.x, std::min(b.x, c.x)) - 0.5f), 0);
+		t.maxX = std::min((int)std::floor(std::max(a.x, std::max(b.x, c.x)) - 0.5f), WIDTH - 1);
+		t.minY = std::max((int)std::ceil(std::min(a.y, std::min(b.y, c.y)) - 0.5f), 0);
+		t.maxY = std::min((int)std::floor(std::max(a.y, std::max(b.y, c.y)) - 0.5f), HEIGHT - 1);
+		if (t.minX > t.maxX || t.minY > t.maxY)
+			return;
+
+		const glm::vec3 *from[3] = { &a, &b, &c }, *to[3] = { &b, &c, &a };
+		for (int e = 0; e < 3; e++)
+		{
+			t.A[e] = from[e]->y - to[e]->y;
+			t.B[e] = to[e]->x - from[e]->x;
+			t.C[e] = -(t.A[e] * from[e]->x + t.B[e] * from[e]->y);
+		}
+		t.zA = ((b.z - a.z) * (c.y - a.y) - (b.y - a.y) * (c.z - a.z)) / area;
+		t.zB = ((b.x - a.x) * (c.z - a.z) - (b.z - a.z) * (c.x - a.x)) / area;
+		t.zC = a.z - t.zA * a.x - t.zB * a.y;
+
+		uint32_t index = (uint32_t)triangles.size();
+		triangles.push_back(t);
+		for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ty++)
+			for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; tx++)
+				bins[ty * TILES_X + tx].push_back(index);
+	}
+
+	// clears one tile and draws its triangles; tiles share nothing, so they run in parallel
+	void rasterizeTile(int tile)
+	{
+		int tileX = (tile % TILES_X) * TILE_SIZE, tileY = (tile / TILES_X) * TILE_SIZE;
+		std::vector<float> &depth = pyramid[0];
+		for (int y = tileY; y < tileY + TILE_SIZE; y++)
+			std::fill(depth.begin() + (size_t)y * WIDTH + tileX, depth.begin() + (size_t)y * WIDTH + tileX + TILE_SIZE, 1.0f);
+
+		const std::vector<uint32_t> &bin = bins[tile];
+		for (size_t i = 0; i < bin.size(); i++)
+		{
+			const ScreenTriangle &t = triangles[bin[i]];
+			// four pixels at a time from a multiple of four; the edge tests reject the extra ones
+			int minX = std::max(t.minX, tileX) & ~3, maxX = std::min(t.maxX, tileX + TILE_SIZE - 1);
+			int minY = std::max(t.minY, tileY), maxY = std::min(t.maxY, tileY + TILE_SIZE - 1);
+			for (int y = minY; y <= maxY; y++)
+			{
+				float *row = &depth[(size_t)y * WIDTH];
+				float py = (float)y + 0.5f;
+#ifdef OCCLUSION_CULLER_SSE2
+				__m128 zero = _mm_setzero_ps(), lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+				__m128 rowE0 = _mm_set1_ps(t.B[0] * py + t.C[0]), rowE1 = _mm_set1_ps(t.B[1] * py + t.C[1]), rowE2 = _mm_set1_ps(t.B[2] * py + t.C[2]);
+				__m128 rowZ = _mm_set1_ps(t.zB * py + t.zC);
+				__m128 a0 = _mm_set1_ps(t.A[0]), a1 = _mm_set1_ps(t.A[1]), a2 = _mm_set1_ps(t.A[2]), zA = _mm_set1_ps(t.zA);
+				for (int x = minX; x <= maxX; x += 4)
+				{
+					__m128 px = _mm_add_ps(_mm_set1_ps((float)x + 0.5f), lanes);
+					__m128 inside = _mm_and_ps(_mm_and_ps(
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), rowE0), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), rowE1), zero)),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), rowE2), zero));
+					__m128 z = _mm_add_ps(_mm_mul_ps(zA, px), rowZ);
+					__m128 old = _mm_loadu_ps(row + x);
+					__m128 nearest = _mm_min_ps(old, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+				}
+#else
+				for (int x = minX; x <= maxX; x++)
+				{
+					float px = (float)x + 0.5f;
+					if (t.A[0] * px + t.B[0] * py + t.C[0] >= 0.0f && t.A[1] * px + t.B[1] * py + t.C[1] >= 0.0f
+						&& t.A[2] * px + t.B[2] * py + t.C[2] >= 0.0f)
+						row[x] = std::min(row[x], t.zA * px + t.zB * py + t.zC);
+				}
+#endif
+			}
+		}
+	}
+
+	// level from the farthest depth of each 2x2 block of the level above
+	void downsample(int level)
+	{
+		int width = WIDTH >> level, height = HEIGHT >> level, sourceWidth = WIDTH >> (level - 1);
+		const std::vector<float> &source = pyramid[level - 1];
+		std::vector<float> &target = pyramid[level];
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+			{
+				const float *top = &source[(size_t)(2 * y) * sourceWidth + 2 * x], *bottom = top + sourceWidth;
+				target[(size_t)y * width + x] = std::max(std::max(top[0], top[1]), std::max(bottom[0], bottom[1]));
+			}
+	}
+};
+
+#endif
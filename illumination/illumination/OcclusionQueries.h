@@ -0,0 +1,196 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "AABB.h"
+#include "Frustum.h"
+#include "GLHandle.h"
+#include "GLState.h"
+#include "Renderable.h"
+#include "Shader.h"
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+// GPU occlusion culling with hardware queries, for --gpu-occlusion. After the scene pass the
+// bounding boxes of the objects due a test are drawn against its depth buffer, without writing
+// anything, each inside a GL_ANY_SAMPLES_PASSED query. A result is only read once the GPU reports
+// it available, a frame or more later, so the CPU never waits; until then the object keeps the
+// visibility it had (coherent hierarchical culling, without the hierarchy):
+// - objects hidden last time are tested every frame, with a cheap box instead of their geometry;
+// - visible ones are drawn directly and re-tested every VISIBLE_INTERVAL frames, staggered.
+// An object that comes into view is drawn one frame after its box first passes.
+// Objects are identified by their index in the entity store; reset() after it changed. The
+// pass recorders skip the objects getHidden() flags (PassDesc::hidden), read on the workers.
+// GL thread only.
+class OcclusionQueries {
+public:
+	static const unsigned int VISIBLE_INTERVAL = 8;
+
+	OcclusionQueries() : frame(0), first(0), queriesIssued(0)
+	{ }
+	~OcclusionQueries()
+	{
+		release();
+	}
+	OcclusionQueries(const OcclusionQueries&) = delete;
+	OcclusionQueries &operator=(const OcclusionQueries&) = delete;
+
+	// the unit cube the boxes are drawn with
+	void create()
+	{
+		static const float corners[8 * 3] = {
+			-0.5f, -0.5f, -0.5f,  0.5f, -0.5f, -0.5f,  -0.5f, 0.5f, -0.5f,  0.5f, 0.5f, -0.5f,
+			-0.5f, -0.5f,  0.5f,  0.5f, -0.5f,  0.5f,  -0.5f, 0.5f,  0.5f,  0.5f, 0.5f,  0.5f };
+		static const GLubyte faces[36] = {
+			0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+			2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5 };
+		VAO = GLVertexArray::create();
+		VBO = GLBuffer::create();
+		EBO = GLBuffer::create();
+		GLStateCache::get().bindVertexArray(VAO.get());
+		glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		GLStateCache::get().bindVertexArray(0);
+	}
+
+	// the objects from index first on are tested, all of them visible until their first result
+	void reset(size_t count, size_t first)
+	{
+		release();
+		this->first = first;
+		states.assign(count, State());
+		hidden.assign(count, 0);
+	}
+
+	// per object, nonzero if its last result found it hidden
+	const std::vector<unsigned char> &getHidden() const
+	{
+		return hidden;
+	}
+
+	// reads back the results the GPU has finished, without waiting for the others
+	void collect()
+	{
+		for (size_t i = 0; i < states.size(); i++)
+		{
+			State &state = states[i];
+			if (!state.pending)
+				continue;
+			GLuint available = 0;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+			GLuint passed = 0;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &passed);
+			hidden[i] = passed == 0;
+			state.pending = false;
+		}
+	}
+
+	// tests the boxes due a test against the bound depth buffer, that of the scene pass seen through
+	// viewProjection from eye; boxShader is occlusion_box.vs with an empty fragment shader
+	void issue(const Shader &boxShader, const EntityStore &objects, const glm::mat4 &viewProjection, const glm::vec3 &eye)
+	{
+		GLStateCache &state = GLStateCache::get();
+		Frustum frustum(viewProjection);
+		queriesIssued = 0;
+		bool began = false;
+		for (size_t i = first; i < states.size() && i < objects.size(); i++)
+		{
+			State &object = states[i];
+			const AABB &bounds = objects.getWorldBounds(i);
+			// outside the view the test means nothing, and with the eye inside the box it would fail:
+			// drawn as soon as it is in view
+			if (!frustum.isVisible(bounds) || isInside(bounds, eye))
+			{
+				hidden[i] = 0;
+				continue;
+			}
+			if (object.pending || (!hidden[i] && (frame + i) % VISIBLE_INTERVAL != 0))
+				continue;
+
+			if (!began)
+			{
+				state.useProgram(boxShader.getProgramID());
+				boxShader.setMat4("viewProjection", viewProjection);
+				state.bindVertexArray(VAO.get());
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				glDepthMask(GL_FALSE);
+				glDepthFunc(GL_LEQUAL); // faces on the surface they bound count as visible
+				began = true;
+			}
+			if (!object.query)
+				glGenQueries(1, &object.query);
+			glm::mat4 model;
+			model = glm::translate(model, bounds.getCenter());
+			model = glm::scale(model, bounds.getExtent() * 2.0f);
+			boxShader.setMat4("model", model);
+			glBeginQuery(GL_ANY_SAMPLES_PASSED, object.query);
+			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (void*)0);
+			glEndQuery(GL_ANY_SAMPLES_PASSED);
+			object.pending = true;
+			queriesIssued++;
+		}
+		if (began)
+		{
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthMask(GL_TRUE);
+			glDepthFunc(GL_LESS);
+		}
+		frame++;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		size_t hiddenCount = 0;
+		for (size_t i = first; i < hidden.size(); i++)
+			if (hidden[i])
+				hiddenCount++;
+		out << "GPU occlusion: " << hiddenCount << " of " << (states.size() > first ? states.size() - first : 0)
+			<< " model meshes hidden, " << queriesIssued << " box queries last frame" << std::endl;
+	}
+
+private:
+	struct State {
+		GLuint query;
+		bool pending; // a query is in flight
+		State() : query(0), pending(false)
+		{ }
+	};
+
+	GLVertexArray VAO;
+	GLBuffer VBO, EBO;
+	std::vector<State> states;
+	std::vector<unsigned char> hidden;
+	unsigned int frame;
+	size_t first;
+	size_t queriesIssued;
+
+	static bool isInside(const AABB &bounds, const glm::vec3 &eye)
+	{
+		// with a margin for the near plane
+		glm::vec3 low = bounds.getMin() - glm::vec3(0.2f), high = bounds.getMax() + glm::vec3(0.2f);
+		return eye.x >= low.x && eye.y >= low.y && eye.z >= low.z && eye.x <= high.x && eye.y <= high.y && eye.z <= high.z;
+	}
+
+	void release()
+	{
+		for (size_t i = 0; i < states.size(); i++)
+			if (states[i].query)
+				glDeleteQueries(1, &states[i].query);
+		states.clear();
+		hidden.clear();
+	}
+};
+
+#endif
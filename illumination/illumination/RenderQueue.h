@@ -0,0 +1,315 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "GLState.h"
+#include "Material.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// coarse ordering of draws inside one queue, stored in the top bits of the sort key
+enum class Render_Layer
+{
+	SHADOW = 0,  // depth-only geometry
+	SOLID = 1,   // opaque geometry, front to back
+	BLENDED = 2  // translucent geometry, back to front
+};
+
+// everything needed to issue one draw call
+struct DrawItem {
+	const Shader *shader;
+	const Material *material; // may be NULL
+	GLuint vao;
+	GLenum mode;
+	GLint first;
+	GLsizei count;
+	GLint baseVertex; // added to the indices of indexed draws
+	bool indexed;
+	glm::mat4 model;
+	GLint layerMask;  // layered passes: bit i set if the draw reaches layer i (uniform "layerMask"); 0 otherwise
+};
+
+// Uniform values shared by every draw of a pass. They can be recorded on any thread;
+// the queue applies them on the GL thread to each program the first time the pass uses it.
+class UniformBlock {
+public:
+	void clear()
+	{
+		values.clear();
+	}
+
+	void setInt(const std::string &name, int value)
+	{
+		Value &v = add(name, Uniform_Type::INT);
+		v.i = value;
+	}
+	void setBool(const std::string &name, bool value)
+	{
+		setInt(name, (int)value);
+	}
+	void setFloat(const std::string &name, float value)
+	{
+		Value &v = add(name, Uniform_Type::FLOAT);
+		v.f[0] = value;
+	}
+	void setVec3(const std::string &name, const glm::vec3 &value)
+	{
+		Value &v = add(name, Uniform_Type::VEC3);
+		std::memcpy(v.f, &value[0], sizeof(float) * 3);
+	}
+	void setMat4(const std::string &name, const glm::mat4 &value)
+	{
+		Value &v = add(name, Uniform_Type::MAT4);
+		std::memcpy(v.f, &value[0][0], sizeof(float) * 16);
+	}
+
+	// uniforms the program doesn't declare are silently ignored by GL (location -1)
+	void apply(const Shader &shader) const
+	{
+		GLuint program = shader.getProgramID();
+		for (unsigned int i = 0; i < values.size(); i++)
+		{
+			const Value &v = values[i];
+			GLint location = glGetUniformLocation(program, v.name.c_str());
+			switch (v.type)
+			{
+			case Uniform_Type::INT:
+				glUniform1i(location, v.i);
+				break;
+			case Uniform_Type::FLOAT:
+				glUniform1f(location, v.f[0]);
+				break;
+			case Uniform_Type::VEC3:
+				glUniform3fv(location, 1, v.f);
+				break;
+			case Uniform_Type::MAT4:
+				glUniformMatrix4fv(location, 1, GL_FALSE, v.f);
+				break;
+			}
+		}
+	}
+
+private:
+	enum class Uniform_Type { INT, FLOAT, VEC3, MAT4 };
+	struct Value {
+		std::string name;
+		Uniform_Type type;
+		int i;
+		float f[16];
+	};
+	std::vector<Value> values;
+
+	Value &add(const std::string &name, Uniform_Type type)
+	{
+		values.push_back(Value());
+		values.back().name = name;
+		values.back().type = type;
+		return values.back();
+	}
+};
+
+// Collects the draws of one pass, orders them by a 64-bit key and submits them.
+// Key layout, most significant first:
+//   [63..60] layer   [59..48] program   [47..24] material   [23..0] depth
+// so draws sharing a program and textures end up adjacent, and inside a state group
+// opaque draws go front to back (early-Z) and translucent ones back to front.
+// Adjacent indexed draws from the same VAO with the same material and transform (the meshes of a
+// ModelBatch) are submitted as one glMultiDrawElementsBaseVertex.
+// Recording (add, append, sort) touches no GL state and may run on a worker thread;
+// submit must run on the GL thread.
+class RenderQueue {
+public:
+	UniformBlock passUniforms;
+
+	RenderQueue() : depthRange(100.0f), drawCalls(0)
+	{ }
+
+	// starts a new frame for this queue; view is used to compute per-draw depth
+	void begin(const glm::mat4 &view, float farPlane = 100.0f)
+	{
+		this->view = view;
+		depthRange = farPlane;
+		items.clear();
+		entries.clear();
+		passUniforms.clear();
+	}
+
+	// moves the draws recorded by another queue (e.g. one chunk of a pass recorded in parallel) into this one
+	void append(const RenderQueue &other)
+	{
+		uint32_t base = (uint32_t)items.size();
+		items.insert(items.end(), other.items.begin(), other.items.end());
+		for (size_t i = 0; i < other.entries.size(); i++)
+		{
+			SortEntry entry = other.entries[i];
+			entry.index += base;
+			entries.push_back(entry);
+		}
+	}
+
+	void add(Render_Layer layer, const DrawItem &item, const AABB &worldBounds)
+	{
+		glm::vec4 center = view * glm::vec4(worldBounds.getCenter(), 1.0f);
+		float depth = -center.z;
+		SortEntry entry;
+		entry.key = makeSortKey(layer, item.shader->getProgramID(), item.material ? item.material->getID() : 0, depth);
+		entry.index = (uint32_t)items.size();
+		entries.push_back(entry);
+		items.push_back(item);
+	}
+
+	size_t size() const
+	{
+		return items.size();
+	}
+	// GL draw calls the last submit issued for them
+	size_t getDrawCalls() const
+	{
+		return drawCalls;
+	}
+
+	uint64_t makeSortKey(Render_Layer layer, GLuint program, unsigned int material, float depth) const
+	{
+		const uint32_t DEPTH_MAX = (1u << 24) - 1;
+		float normalized = depth / depthRange;
+		if (normalized < 0.0f)
+			normalized = 0.0f;
+		if (normalized > 1.0f)
+			normalized = 1.0f;
+		uint32_t depthBits = (uint32_t)(normalized * DEPTH_MAX);
+		if (layer == Render_Layer::BLENDED)
+			depthBits = DEPTH_MAX - depthBits;
+
+		return ((uint64_t)layer & 0xF) << 60
+			| ((uint64_t)program & 0xFFF) << 48
+			| ((uint64_t)material & 0xFFFFFF) << 24
+			| depthBits;
+	}
+
+	// LSD radix sort on the keys, 8 bits per pass; passes where every key has the same byte are skipped
+	void sort()
+	{
+		size_t n = entries.size();
+		if (n < 2)
+			return;
+		scratch.resize(n);
+		SortEntry *src = &entries[0], *dst = &scratch[0];
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t histogram[256];
+			std::memset(histogram, 0, sizeof(histogram));
+			for (size_t i = 0; i < n; i++)
+				histogram[(src[i].key >> shift) & 0xFF]++;
+			if (histogram[(src[0].key >> shift) & 0xFF] == n)
+				continue;
+
+			size_t offset = 0;
+			for (int b = 0; b < 256; b++)
+			{
+				size_t count = histogram[b];
+				histogram[b] = offset;
+				offset += count;
+			}
+			for (size_t i = 0; i < n; i++)
+				dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+			std::swap(src, dst);
+		}
+		if (src != &entries[0])
+			entries.swap(scratch);
+	}
+
+	// issues the sorted draws, applying passUniforms to each program on its first use in the pass
+	void submit() const
+	{
+		GLStateCache &state = GLStateCache::get();
+		GLuint lastProgram = 0;
+		const Material *lastMaterial = NULL;
+		std::vector<GLuint> preparedPrograms;
+		drawCalls = 0;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			const DrawItem &item = items[entries[i].index];
+			GLuint program = item.shader->getProgramID();
+			bool programChanged = program != lastProgram;
+			state.useProgram(program);
+			if (programChanged && std::find(preparedPrograms.begin(), preparedPrograms.end(), program) == preparedPrograms.end())
+			{
+				passUniforms.apply(*item.shader);
+				preparedPrograms.push_back(program);
+			}
+			if (item.material && (programChanged || item.material != lastMaterial))
+			{
+				item.material->setSamplers(*item.shader);
+				item.material->bind();
+			}
+			lastProgram = program;
+			lastMaterial = item.material;
+
+			item.shader->setMat4("model", item.model);
+			if (item.layerMask)
+				item.shader->setInt("layerMask", item.layerMask);
+			state.bindVertexArray(item.vao);
+			drawCalls++;
+
+			size_t run = 1;
+			while (i + run < entries.size() && canMerge(item, items[entries[i + run].index]))
+				run++;
+			if (run > 1)
+			{
+				multiCounts.resize(run);
+				multiOffsets.resize(run);
+				multiBaseVertices.resize(run);
+				for (size_t j = 0; j < run; j++)
+				{
+					const DrawItem &part = items[entries[i + j].index];
+					multiCounts[j] = part.count;
+					multiOffsets[j] = (void*)(part.first * sizeof(unsigned int));
+					multiBaseVertices[j] = part.baseVertex;
+				}
+				glMultiDrawElementsBaseVertex(item.mode, &multiCounts[0], GL_UNSIGNED_INT, &multiOffsets[0], (GLsizei)run, &multiBaseVertices[0]);
+				i += run - 1;
+			}
+			else if (item.indexed && item.baseVertex != 0)
+				glDrawElementsBaseVertex(item.mode, item.count, GL_UNSIGNED_INT, (void*)(item.first * sizeof(unsigned int)), item.baseVertex);
+			else if (item.indexed)
+				glDrawElements(item.mode, item.count, GL_UNSIGNED_INT, (void*)(item.first * sizeof(unsigned int)));
+			else
+				glDrawArrays(item.mode, item.first, item.count);
+		}
+	}
+
+private:
+	struct SortEntry {
+		uint64_t key;
+		uint32_t index;
+	};
+
+	glm::mat4 view;
+	float depthRange;
+	std::vector<DrawItem> items;
+	std::vector<SortEntry> entries;
+	std::vector<SortEntry> scratch;
+	// submit's multi-draw arguments, kept to avoid reallocating every frame
+	mutable std::vector<GLsizei> multiCounts;
+	mutable std::vector<const void*> multiOffsets;
+	mutable std::vector<GLint> multiBaseVertices;
+	mutable size_t drawCalls;
+
+	// whether next can be drawn by the same multi-draw as item: nothing a draw sets may differ
+	static bool canMerge(const DrawItem &item, const DrawItem &next)
+	{
+		return item.indexed && next.indexed && item.vao == next.vao && item.shader == next.shader && item.material == next.material
+			&& item.mode == next.mode && item.layerMask == next.layerMask && std::memcmp(&item.model[0][0], &next.model[0][0], sizeof(float) * 16) == 0;
+	}
+};
+
+#endif
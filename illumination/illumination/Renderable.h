@@ -0,0 +1,158 @@
+#ifndef RENDERABLE_H
+#define RENDERABLE_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "EntityStore.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "Material.h"
+#include "OcclusionCuller.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+#include "TextureResidency.h"
+
+#include <vector>
+
+// what a pass draws and from where
+struct PassDesc {
+	glm::mat4 view;
+	glm::mat4 projection;
+	float farPlane;
+	const Shader *depthShader; // set for depth-only passes: everything is drawn with it, without textures
+	bool castersOnly;          // depth-only passes: shadow passes take the objects casting shadows, the depth pre-pass the SOLID ones
+	bool gbuffer;              // G-buffer pass: objects are drawn with their gbufferShader, those without one are skipped
+	bool cull;                 // skip objects outside the view frustum
+	// depth-only passes: also skip casters whose shadow, cast away from lightPosition, misses this
+	// frustum (the camera's), or NULL
+	const Frustum *receiverFrustum;
+	glm::vec3 lightPosition;
+	const OcclusionCuller *occlusion; // skip objects hidden behind its occluders, or NULL; rendered for this view
+	const std::vector<unsigned char> *hidden; // per object, nonzero: skip it (OcclusionQueries), or NULL
+	// layered passes (the faces of a cube shadow map): the view-projection of each layer, or NULL.
+	// Each draw gets the mask of the layers whose frustum it reaches; culling uses those frusta.
+	const glm::mat4 *layerViewProjections;
+	unsigned int layerCount;
+	bool textureFeedback;      // report the screen size of materials to the texture residency manager
+	float viewportHeight;      // in pixels, for textureFeedback
+};
+
+// Records passes into render queues: the draw submission system of the EntityStore. Large stores are
+// split into chunks recorded in parallel on the job system and merged before the sort; nothing here
+// touches GL.
+class PassRecorder {
+public:
+	static const size_t CHUNK_SIZE = 256;
+
+	PassRecorder() : culled(0), layerDraws(0)
+	{ }
+
+	void record(JobSystem &jobs, RenderQueue &queue, const PassDesc &pass, const EntityStore &objects)
+	{
+		queue.begin(pass.view, pass.farPlane);
+		Frustum frustum(pass.projection * pass.view);
+		layerFrusta.resize(pass.layerViewProjections ? pass.layerCount : 0);
+		for (unsigned int i = 0; i < layerFrusta.size(); i++)
+			layerFrusta[i] = Frustum(pass.layerViewProjections[i]);
+		size_t chunkCount = (objects.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		if (chunkCount <= 1)
+		{
+			culled = recordRange(queue, pass, frustum, layerFrusta, objects, 0, objects.size(), layerDraws);
+		}
+		else
+		{
+			chunks.resize(chunkCount);
+			chunkCulled.resize(chunkCount);
+			chunkLayerDraws.resize(chunkCount);
+			jobs.parallelFor(objects.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+				size_t chunk = begin / CHUNK_SIZE;
+				chunks[chunk].begin(pass.view, pass.farPlane);
+				chunkCulled[chunk] = recordRange(chunks[chunk], pass, frustum, layerFrusta, objects, begin, end, chunkLayerDraws[chunk]);
+			});
+			culled = 0;
+			layerDraws = 0;
+			for (size_t i = 0; i < chunkCount; i++)
+			{
+				queue.append(chunks[i]);
+				culled += chunkCulled[i];
+				layerDraws += chunkLayerDraws[i];
+			}
+		}
+		queue.sort();
+	}
+
+	// objects rejected by the frustum and occlusion tests in the last recorded pass
+	size_t getCulledCount() const
+	{
+		return culled;
+	}
+	// layered passes: draws times the layers each reaches, i.e. the draws a pass per layer would issue
+	size_t getLayerDrawCount() const
+	{
+		return layerDraws;
+	}
+
+private:
+	std::vector<RenderQueue> chunks;
+	std::vector<size_t> chunkCulled, chunkLayerDraws;
+	std::vector<Frustum> layerFrusta;
+	size_t culled;
+	size_t layerDraws;
+
+	static size_t recordRange(RenderQueue &queue, const PassDesc &pass, const Frustum &frustum, const std::vector<Frustum> &layerFrusta,
+		const EntityStore &objects, size_t begin, size_t end, size_t &layerDraws)
+	{
+		size_t rejected = 0;
+		layerDraws = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			const EntityStore::MaterialRef &object = objects.getMaterial(i);
+			if (pass.depthShader && (pass.castersOnly ? !object.castsShadow : object.layer != Render_Layer::SOLID))
+				continue;
+			if (pass.gbuffer && !object.gbufferShader)
+				continue;
+			if (pass.hidden && i < pass.hidden->size() && (*pass.hidden)[i])
+			{
+				rejected++;
+				continue;
+			}
+			const AABB &worldBounds = objects.getWorldBounds(i);
+			GLint layerMask = 0;
+			for (unsigned int l = 0; l < layerFrusta.size(); l++)
+				if (!pass.cull || layerFrusta[l].isVisible(worldBounds))
+					layerMask |= 1 << l;
+			bool visible = layerFrusta.empty() ? !pass.cull || frustum.isVisible(worldBounds) : layerMask != 0;
+			if (!visible || (pass.receiverFrustum && !pass.receiverFrustum->isShadowVisible(worldBounds, pass.lightPosition))
+				|| (pass.occlusion && !pass.occlusion->isVisible(worldBounds)))
+			{
+				rejected++;
+				continue;
+			}
+			for (GLint mask = layerMask; mask; mask &= mask - 1)
+				layerDraws++;
+
+			if (pass.textureFeedback)
+				TextureResidency::get().noteUsage(object.material, ProjectedPixels(worldBounds, pass.view, pass.projection, pass.viewportHeight));
+
+			const EntityStore::MeshRef &mesh = objects.getMesh(i);
+			DrawItem item;
+			item.shader = pass.depthShader ? pass.depthShader : pass.gbuffer ? object.gbufferShader : object.shader;
+			item.material = pass.depthShader ? NULL : object.material;
+			item.vao = mesh.vao;
+			item.mode = mesh.mode;
+			item.first = mesh.first;
+			item.count = mesh.count;
+			item.baseVertex = mesh.baseVertex;
+			item.indexed = mesh.indexed;
+			item.model = objects.getWorld(i);
+			item.layerMask = layerMask;
+			queue.add(pass.depthShader ? Render_Layer::SHADOW : object.layer, item, worldBounds);
+		}
+		return rejected;
+	}
+};
+
+#endif
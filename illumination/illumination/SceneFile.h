@@ -0,0 +1,462 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The scene description: objects with their transforms, materials, lights and the assets they
+// reference. It is written by hand as text (scene.txt) and can be compiled into a binary image
+// (--compile-scene) that loads with a single read: the image is the records themselves, laid out
+// as they sit in memory, and the only work on load is turning the offsets it stores into pointers.
+//
+// Text format, one record per line, '#' starts a comment:
+//   material <name> [diffuse r g b] [specular r g b] [shininess s] [texture path]
+//   light <name> position x y z [ambient r g b] [diffuse r g b] [specular r g b]
+//   object <name> <shape> [asset path] [material name] [parent name] [translate x y z | scale x y z |
+//          scale s | rotate degrees x y z]...
+// A material or parent must be declared before the objects using it, so the objects are in the order
+// SceneGraph wants them. The transform operations multiply on the right, in the order written, like
+// the glm::translate/glm::scale calls they replace. Shapes are interpreted by the application.
+
+// an offset from the start of the image on disk, a pointer into it once loaded
+template <typename T>
+union ScenePointer {
+	uint64_t offset;
+	T *pointer;
+};
+
+struct SceneMaterial {
+	ScenePointer<const char> name;
+	ScenePointer<const char> texture; // "" if none
+	float diffuse[3];
+	float specular[3];
+	float shininess;
+	uint32_t padding;
+};
+
+struct SceneLight {
+	ScenePointer<const char> name;
+	float position[3];
+	float ambient[3];
+	float diffuse[3];
+	float specular[3];
+};
+
+struct SceneObject {
+	ScenePointer<const char> name;
+	ScenePointer<const char> shape;
+	ScenePointer<const char> asset; // "" if none
+	int32_t material;               // index in the materials, -1 for the default one
+	int32_t parent;                 // index of an earlier object, -1 for none
+	float transform[16];            // relative to the parent, column-major like glm
+};
+
+struct SceneHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t objectCount;
+	uint32_t materialCount;
+	uint32_t lightCount;
+	uint32_t padding;
+	ScenePointer<SceneObject> objects;
+	ScenePointer<SceneMaterial> materials;
+	ScenePointer<SceneLight> lights;
+	ScenePointer<const char> strings; // every string, null-terminated, starting with ""
+	uint64_t size;                    // of the whole image
+};
+
+class SceneFile {
+public:
+	static const uint32_t VERSION = 1;
+
+	SceneFile() : header(NULL)
+	{ }
+	// the image holds pointers into itself
+	SceneFile(const SceneFile&) = delete;
+	SceneFile &operator=(const SceneFile&) = delete;
+
+	// a compiled scene if the path ends in .bin, the text format otherwise
+	bool load(const std::string &path)
+	{
+		if (path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0)
+			return loadBinary(path);
+		return loadText(path);
+	}
+
+	// parses the text format and compiles it in memory
+	bool loadText(const std::string &path)
+	{
+		std::ifstream file(path.c_str());
+		if (!file)
+		{
+			std::cout << "ERROR::SCENE:: cannot open " << path << std::endl;
+			return false;
+		}
+		Source source;
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+			std::string::size_type comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+			std::istringstream in(line);
+			std::string keyword;
+			if (!(in >> keyword))
+				continue;
+			std::string error = parseRecord(keyword, in, source);
+			if (!error.empty())
+			{
+				std::cout << "ERROR::SCENE:: " << path << ":" << lineNumber << ": " << error << std::endl;
+				return false;
+			}
+		}
+		compile(source);
+		return true;
+	}
+
+	// reads a compiled image at once and fixes its pointers up
+	bool loadBinary(const std::string &path)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			std::cout << "ERROR::SCENE:: cannot open " << path << std::endl;
+			return false;
+		}
+		size_t size = (size_t)file.tellg();
+		file.seekg(0);
+		image.assign((size + 7) / 8, 0);
+		header = NULL;
+		if (size < sizeof(SceneHeader) || !file.read((char*)&image[0], size))
+		{
+			std::cout << "ERROR::SCENE:: " << path << " is truncated" << std::endl;
+			return false;
+		}
+		if (!relocate(size))
+		{
+			std::cout << "ERROR::SCENE:: " << path << " is not a compiled scene of version " << VERSION << std::endl;
+			image.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// writes the compiled image, offsets in place of the pointers
+	bool saveBinary(const std::string &path) const
+	{
+		if (!header)
+			return false;
+		std::vector<uint64_t> copy(image);
+		const char *base = (const char*)&image[0];
+		SceneHeader *out = (SceneHeader*)&copy[0];
+		// the records sit at the same offsets in the copy, still pointing into the image
+		SceneObject *objects = (SceneObject*)((char*)&copy[0] + ((const char*)header->objects.pointer - base));
+		SceneMaterial *materials = (SceneMaterial*)((char*)&copy[0] + ((const char*)header->materials.pointer - base));
+		SceneLight *lights = (SceneLight*)((char*)&copy[0] + ((const char*)header->lights.pointer - base));
+		forEachPointer(out, objects, materials, lights, [base](uint64_t &slot) {
+			slot = (uint64_t)(*(const char**)&slot - base);
+		});
+		std::ofstream file(path.c_str(), std::ios::binary);
+		if (!file.write((const char*)&copy[0], header->size))
+		{
+			std::cout << "ERROR::SCENE:: cannot write " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int getObjectCount() const
+	{
+		return header ? header->objectCount : 0;
+	}
+	const SceneObject &getObject(unsigned int i) const
+	{
+		return header->objects.pointer[i];
+	}
+
+	unsigned int getLightCount() const
+	{
+		return header ? header->lightCount : 0;
+	}
+	const SceneLight &getLight(unsigned int i) const
+	{
+		return header->lights.pointer[i];
+	}
+
+	// the material of the given index, or the default one for -1
+	const SceneMaterial &getMaterial(int i) const
+	{
+		static const SceneMaterial DEFAULT_MATERIAL = { { 0 }, { 0 }, { 1.0f, 1.0f, 1.0f }, { 0.5f, 0.5f, 0.5f }, 32.0f, 0 };
+		return i >= 0 ? header->materials.pointer[i] : DEFAULT_MATERIAL;
+	}
+
+	static glm::mat4 getTransform(const SceneObject &object)
+	{
+		glm::mat4 m;
+		for (int column = 0; column < 4; column++)
+			for (int row = 0; row < 4; row++)
+				m[column][row] = object.transform[column * 4 + row];
+		return m;
+	}
+
+	size_t getImageBytes() const
+	{
+		return header ? (size_t)header->size : 0;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Scene: " << getObjectCount() << " objects, " << (header ? header->materialCount : 0) << " materials, "
+			<< getLightCount() << " lights, " << getImageBytes() << " byte image" << std::endl;
+	}
+
+private:
+	// what the text parser collects before compile() lays it out
+	struct Source {
+		std::vector<SceneMaterial> materials;
+		std::vector<SceneLight> lights;
+		std::vector<SceneObject> objects;
+		std::vector<std::string> materialNames, lightNames, objectNames;
+		std::vector<std::string> strings; // the strings of the records, which hold their index until compile()
+	};
+
+	std::vector<uint64_t> image; // 8-byte aligned
+	const SceneHeader *header;
+
+	// the string fields of the records hold an index in Source::strings until compile()
+	static uint64_t addString(Source &source, const std::string &value)
+	{
+		source.strings.push_back(value);
+		return source.strings.size() - 1;
+	}
+
+	static bool readVec3(std::istream &in, float *out)
+	{
+		return (bool)(in >> out[0] >> out[1] >> out[2]);
+	}
+
+	static int find(const std::vector<std::string> &names, const std::string &name)
+	{
+		for (size_t i = 0; i < names.size(); i++)
+			if (names[i] == name)
+				return (int)i;
+		return -1;
+	}
+
+	// one line; returns the error, empty if none
+	static std::string parseRecord(const std::string &keyword, std::istream &in, Source &source)
+	{
+		std::string name, key;
+		if (!(in >> name))
+			return keyword + " without a name";
+		if (keyword == "material")
+		{
+			SceneMaterial material = { { 0 }, { 0 }, { 1.0f, 1.0f, 1.0f }, { 0.5f, 0.5f, 0.5f }, 32.0f, 0 };
+			material.name.offset = addString(source, name);
+			material.texture.offset = addString(source, "");
+			while (in >> key)
+			{
+				std::string texture;
+				if (!(key == "diffuse" ? readVec3(in, material.diffuse) : key == "specular" ? readVec3(in, material.specular)
+					: key == "shininess" ? (bool)(in >> material.shininess) : key == "texture" && (bool)(in >> texture)))
+					return "bad material property '" + key + "'";
+				if (!texture.empty())
+					source.strings[material.texture.offset] = texture;
+			}
+			source.materials.push_back(material);
+			source.materialNames.push_back(name);
+		}
+		else if (keyword == "light")
+		{
+			SceneLight light = { { 0 }, { 0.0f, 0.0f, 0.0f }, { 0.2f, 0.2f, 0.2f }, { 0.5f, 0.5f, 0.5f }, { 1.0f, 1.0f, 1.0f } };
+			light.name.offset = addString(source, name);
+			while (in >> key)
+				if (!(key == "position" ? readVec3(in, light.position) : key == "ambient" ? readVec3(in, light.ambient)
+					: key == "diffuse" ? readVec3(in, light.diffuse) : key == "specular" && readVec3(in, light.specular)))
+					return "bad light property '" + key + "'";
+			source.lights.push_back(light);
+			source.lightNames.push_back(name);
+		}
+		else if (keyword == "object")
+		{
+			std::string shape;
+			if (!(in >> shape))
+				return "object " + name + " without a shape";
+			SceneObject object;
+			object.name.offset = addString(source, name);
+			object.shape.offset = addString(source, shape);
+			object.asset.offset = addString(source, "");
+			object.material = -1;
+			object.parent = -1;
+			glm::mat4 transform;
+			while (in >> key)
+			{
+				std::string value;
+				glm::vec3 v;
+				float angle;
+				if (key == "asset" && in >> value)
+					source.strings[object.asset.offset] = value;
+				else if (key == "material" && in >> value)
+				{
+					object.material = find(source.materialNames, value);
+					if (object.material < 0)
+						return "unknown material " + value;
+				}
+				else if (key == "parent" && in >> value)
+				{
+					object.parent = find(source.objectNames, value);
+					if (object.parent < 0)
+						return "unknown parent " + value;
+				}
+				else if (key == "translate" && readVec3(in, &v[0]))
+					transform = glm::translate(transform, v);
+				else if (key == "rotate" && in >> angle && readVec3(in, &v[0]))
+					transform = glm::rotate(transform, glm::radians(angle), v);
+				else if (key == "scale" && in >> v.x)
+				{
+					// one factor or three
+					if (!(in >> v.y))
+					{
+						in.clear();
+						transform = glm::scale(transform, glm::vec3(v.x));
+					}
+					else if (in >> v.z)
+						transform = glm::scale(transform, v);
+					else
+						return "scale takes one factor or three";
+				}
+				else
+					return "bad object property '" + key + "'";
+			}
+			for (int column = 0; column < 4; column++)
+				for (int row = 0; row < 4; row++)
+					object.transform[column * 4 + row] = transform[column][row];
+			source.objects.push_back(object);
+			source.objectNames.push_back(name);
+		}
+		else
+			return "unknown record '" + keyword + "'";
+		return std::string();
+	}
+
+	// lays the records out in one image, strings last, and fixes it up like a loaded one
+	void compile(const Source &source)
+	{
+		size_t objectsAt = sizeof(SceneHeader);
+		size_t materialsAt = objectsAt + source.objects.size() * sizeof(SceneObject);
+		size_t lightsAt = materialsAt + source.materials.size() * sizeof(SceneMaterial);
+		size_t stringsAt = lightsAt + source.lights.size() * sizeof(SceneLight);
+		std::vector<uint64_t> stringOffsets(source.strings.size());
+		size_t size = stringsAt + 1; // the shared ""
+		for (size_t i = 0; i < source.strings.size(); i++)
+		{
+			stringOffsets[i] = source.strings[i].empty() ? stringsAt : size;
+			if (!source.strings[i].empty())
+				size += source.strings[i].size() + 1;
+		}
+
+		image.assign((size + 7) / 8, 0);
+		char *base = (char*)&image[0];
+		SceneHeader *out = (SceneHeader*)base;
+		std::memcpy(out->magic, "SCNB", 4);
+		out->version = VERSION;
+		out->objectCount = (uint32_t)source.objects.size();
+		out->materialCount = (uint32_t)source.materials.size();
+		out->lightCount = (uint32_t)source.lights.size();
+		out->objects.offset = objectsAt;
+		out->materials.offset = materialsAt;
+		out->lights.offset = lightsAt;
+		out->strings.offset = stringsAt;
+		out->size = size;
+		SceneObject *objects = (SceneObject*)(base + objectsAt);
+		SceneMaterial *materials = (SceneMaterial*)(base + materialsAt);
+		SceneLight *lights = (SceneLight*)(base + lightsAt);
+		if (!source.objects.empty())
+			std::memcpy(objects, &source.objects[0], source.objects.size() * sizeof(SceneObject));
+		if (!source.materials.empty())
+			std::memcpy(materials, &source.materials[0], source.materials.size() * sizeof(SceneMaterial));
+		if (!source.lights.empty())
+			std::memcpy(lights, &source.lights[0], source.lights.size() * sizeof(SceneLight));
+		for (size_t i = 0; i < source.strings.size(); i++)
+			if (!source.strings[i].empty())
+				std::memcpy(base + stringOffsets[i], source.strings[i].c_str(), source.strings[i].size() + 1);
+		// string indices to offsets
+		forEachPointer(NULL, objects, materials, lights, [&](uint64_t &slot) {
+			slot = stringOffsets[slot];
+		}, out);
+		relocate(size);
+	}
+
+	// calls fix on every string field of the records; with header, on the header's pointers too
+	template <typename F>
+	static void forEachPointer(SceneHeader *header, SceneObject *objects, SceneMaterial *materials, SceneLight *lights, F fix, const SceneHeader *counts = NULL)
+	{
+		const SceneHeader *sizes = counts ? counts : header;
+		for (uint32_t i = 0; i < sizes->objectCount; i++)
+		{
+			fix(objects[i].name.offset);
+			fix(objects[i].shape.offset);
+			fix(objects[i].asset.offset);
+		}
+		for (uint32_t i = 0; i < sizes->materialCount; i++)
+		{
+			fix(materials[i].name.offset);
+			fix(materials[i].texture.offset);
+		}
+		for (uint32_t i = 0; i < sizes->lightCount; i++)
+			fix(lights[i].name.offset);
+		if (header)
+		{
+			fix(header->objects.offset);
+			fix(header->materials.offset);
+			fix(header->lights.offset);
+			fix(header->strings.offset);
+		}
+	}
+
+	// checks the offsets of the image and turns them into pointers
+	bool relocate(size_t size)
+	{
+		char *base = (char*)&image[0];
+		SceneHeader *in = (SceneHeader*)base;
+		if (size < sizeof(SceneHeader) || std::memcmp(in->magic, "SCNB", 4) != 0 || in->version != VERSION || in->size != size || base[size - 1] != '\0')
+			return false;
+		// exactly the layout compile() writes: the header, then the objects, materials and lights back to
+		// back, then the strings; no two parts can overlap
+		uint64_t materialsAt = sizeof(SceneHeader) + (uint64_t)in->objectCount * sizeof(SceneObject);
+		uint64_t lightsAt = materialsAt + (uint64_t)in->materialCount * sizeof(SceneMaterial);
+		uint64_t stringsAt = lightsAt + (uint64_t)in->lightCount * sizeof(SceneLight);
+		if (in->objects.offset != sizeof(SceneHeader) || in->materials.offset != materialsAt || in->lights.offset != lightsAt
+			|| in->strings.offset != stringsAt || stringsAt >= size)
+			return false;
+		SceneObject *objects = (SceneObject*)(base + in->objects.offset);
+		SceneMaterial *materials = (SceneMaterial*)(base + in->materials.offset);
+		SceneLight *lights = (SceneLight*)(base + in->lights.offset);
+		bool valid = true;
+		forEachPointer(NULL, objects, materials, lights, [&](uint64_t &slot) {
+			valid = valid && slot >= stringsAt && slot < size;
+		}, in);
+		for (uint32_t i = 0; valid && i < in->objectCount; i++)
+			valid = objects[i].parent >= -1 && objects[i].parent < (int32_t)i && objects[i].material >= -1 && objects[i].material < (int32_t)in->materialCount;
+		if (!valid)
+			return false;
+		forEachPointer(in, objects, materials, lights, [base](uint64_t &slot) {
+			*(const char**)&slot = base + slot;
+		});
+		header = in;
+		return true;
+	}
+};
+
+#endif
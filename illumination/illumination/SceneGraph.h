@@ -0,0 +1,122 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+// Transform hierarchy of the scene. Nodes live in flat arrays, local and world matrices apart, and
+// a node can only be added below one that already exists, so the arrays are always in topological
+// order: parents before their children. update() is then a single linear pass that recomputes the
+// world matrix of the nodes whose local matrix changed and of everything below them, starting at the
+// first dirty node; when nothing moved it returns at once.
+// After update(), isChanged() tells which world matrices it rewrote, so whatever copies them (the
+// renderables) only refreshes those. Not thread-safe: updated on the main thread, before the frame
+// is recorded.
+class SceneGraph {
+public:
+	static const int NO_PARENT = -1;
+
+	SceneGraph() : firstDirty(0), lastUpdated(0), totalUpdated(0)
+	{ }
+
+	// a node below parent (NO_PARENT for a root) with the given local transform; returns its index
+	int addNode(int parent, const glm::mat4 &local)
+	{
+		int node = (int)parents.size();
+		if (parent >= node)
+		{
+			std::cout << "ERROR::SCENE_GRAPH:: parent " << parent << " of node " << node << " does not exist" << std::endl;
+			parent = NO_PARENT;
+		}
+		parents.push_back(parent);
+		locals.push_back(local);
+		worlds.push_back(local);
+		dirty.push_back(1);
+		changed.push_back(0);
+		if (firstDirty > (size_t)node)
+			firstDirty = node;
+		return node;
+	}
+
+	void setLocal(int node, const glm::mat4 &local)
+	{
+		locals[node] = local;
+		dirty[node] = 1;
+		if (firstDirty > (size_t)node)
+			firstDirty = node;
+	}
+
+	const glm::mat4 &getLocal(int node) const
+	{
+		return locals[node];
+	}
+
+	// as of the last update()
+	const glm::mat4 &getWorld(int node) const
+	{
+		return worlds[node];
+	}
+
+	int getParent(int node) const
+	{
+		return parents[node];
+	}
+
+	// true if the last update() rewrote the node's world matrix
+	bool isChanged(int node) const
+	{
+		return changed[node] != 0;
+	}
+
+	// propagates the dirty local matrices; returns the number of world matrices recomputed
+	size_t update()
+	{
+		for (size_t i = 0; i < changedNodes.size(); i++)
+			changed[changedNodes[i]] = 0;
+		changedNodes.clear();
+		lastUpdated = 0;
+
+		// nothing before the first dirty node can change
+		for (size_t i = firstDirty; i < parents.size(); i++)
+		{
+			int parent = parents[i];
+			if (!dirty[i] && !(parent != NO_PARENT && changed[parent]))
+				continue;
+			worlds[i] = parent != NO_PARENT ? worlds[parent] * locals[i] : locals[i];
+			dirty[i] = 0;
+			changed[i] = 1;
+			changedNodes.push_back((int)i);
+		}
+		firstDirty = parents.size();
+		lastUpdated = changedNodes.size();
+		totalUpdated += lastUpdated;
+		return lastUpdated;
+	}
+
+	size_t size() const
+	{
+		return parents.size();
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		out << "Scene graph: " << parents.size() << " nodes, " << lastUpdated << " world matrices updated last frame, "
+			<< totalUpdated << " in total" << std::endl;
+	}
+
+private:
+	std::vector<int> parents;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<unsigned char> dirty;   // local changed since the last update()
+	std::vector<unsigned char> changed; // world rewritten by the last update()
+	std::vector<int> changedNodes;      // the nodes flagged in changed, to clear them without a full pass
+	size_t firstDirty;
+	size_t lastUpdated;
+	size_t totalUpdated;
+};
+
+#endif
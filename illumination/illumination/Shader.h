@@ -3,6 +3,9 @@
 
 #include <glad/glad.h>
 
+#include "GLHandle.h"
+#include "GLState.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -15,12 +18,13 @@
 
 // װɫ࣬㡢ƬԪɫӦɫ
 class Shader {
-	GLuint program;
+	GLProgram program;
 
 public:
 	// 캯ļжȡGLSL룬붥ɫƬԪɫȻ󴴽ɫ
-	Shader(const char* vertexPath, const char* fragmentPath) {
-		std::string vertexCode, fragmentCode;
+	// geometryPathǿʱ벢Ӽɫ
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = NULL) {
+		std::string vertexCode, fragmentCode, geometryCode;
 		std::ifstream vShaderFile, fShaderFile;
 
 		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -36,9 +40,18 @@ public:
 			// رļ
 			vShaderFile.close();
 			fShaderFile.close();
-			// stringstreamתΪstring
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
+			// stringstreamתΪstringչе#include
+			vertexCode = expandIncludes(vShaderStream.str(), vertexPath);
+			fragmentCode = expandIncludes(fShaderStream.str(), fragmentPath);
+			if (geometryPath) {
+				std::ifstream gShaderFile;
+				gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+				gShaderFile.open(geometryPath);
+				std::stringstream gShaderStream;
+				gShaderStream << gShaderFile.rdbuf();
+				gShaderFile.close();
+				geometryCode = expandIncludes(gShaderStream.str(), geometryPath);
+			}
 		}
 		catch (std::ifstream::failure e) {
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
@@ -60,65 +73,110 @@ public:
 		glCompileShader(fragment);
 		checkCompileOrLinkingErrors(fragment, "FRAGMENT");
 
+		// 뼸ɫѡ
+		GLuint geometry = 0;
+		if (geometryPath) {
+			const char* gShaderCode = geometryCode.c_str();
+			geometry = glCreateShader(GL_GEOMETRY_SHADER);
+			glShaderSource(geometry, 1, &gShaderCode, NULL);
+			glCompileShader(geometry);
+			checkCompileOrLinkingErrors(geometry, "GEOMETRY");
+		}
+
 		// ɫ
-		program = glCreateProgram();
-		glAttachShader(program, vertex);
-		glAttachShader(program, fragment);
-		glLinkProgram(program);
-		checkCompileOrLinkingErrors(program, "PROGRAM");
+		program = GLProgram::create();
+		glAttachShader(program.get(), vertex);
+		glAttachShader(program.get(), fragment);
+		if (geometry)
+			glAttachShader(program.get(), geometry);
+		glLinkProgram(program.get());
+		checkCompileOrLinkingErrors(program.get(), "PROGRAM");
 
 		// ɾɫ
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
+		if (geometry)
+			glDeleteShader(geometry);
 	}
 
+	// ֻƶܸƣGLProgramУһɾ
+	Shader(Shader &&other) = default;
+	Shader &operator=(Shader &&other) = default;
+
 	// ȡɫID
 	GLuint getProgramID() const {
-		return program;
+		return program.get();
 	}
 
 	// ʹɫ
 	void use() {
-		glUseProgram(program);
+		GLStateCache::get().useProgram(program.get());
 	}
 
 	// uniformֵ
 	// ------------------------------------------------------------------------
 	void setBool(const std::string &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(program, name.c_str()), (int)value);
+		glUniform1i(glGetUniformLocation(program.get(), name.c_str()), (int)value);
 	}
 	// ------------------------------------------------------------------------
 	void setInt(const std::string &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(program, name.c_str()), value);
+		glUniform1i(glGetUniformLocation(program.get(), name.c_str()), value);
 	}
 	// ------------------------------------------------------------------------
 	void setFloat(const std::string &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(program, name.c_str()), value);
+		glUniform1f(glGetUniformLocation(program.get(), name.c_str()), value);
 	}
 	void setVec3(const std::string &name, const glm::vec3 &vecValue) const
 	{
-		glUniform3fv(glGetUniformLocation(program, name.c_str()), 1, glm::value_ptr(vecValue));
+		glUniform3fv(glGetUniformLocation(program.get(), name.c_str()), 1, glm::value_ptr(vecValue));
 	}
 	void setVec3(const std::string &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(program, name.c_str()), x, y, z);
+		glUniform3f(glGetUniformLocation(program.get(), name.c_str()), x, y, z);
 	}
 	void setMat4(const std::string &name, const glm::mat4 &matrixValue) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(program, name.c_str()), 1, GL_FALSE, glm::value_ptr(matrixValue));
+		glUniformMatrix4fv(glGetUniformLocation(program.get(), name.c_str()), 1, GL_FALSE, glm::value_ptr(matrixValue));
 		// 
-		// glUniformMatrix4fv(glGetUniformLocation(program, name.c_str()), 1, GL_FALSE, &matrixValue[0][0]);
+		// glUniformMatrix4fv(glGetUniformLocation(program.get(), name.c_str()), 1, GL_FALSE, &matrixValue[0][0]);
 	}
 
 private:
+	//  #include "file.glsl" 滻Ϊļݣ·ɫļĿ¼
+	// ʹɫԹͬһGLSL룻֧Ƕװ
+	static std::string expandIncludes(const std::string &code, const std::string &path) {
+		std::string directory = path.find_last_of('/') == std::string::npos ? "" : path.substr(0, path.find_last_of('/') + 1);
+		std::istringstream lines(code);
+		std::string line, expanded;
+		while (std::getline(lines, line)) {
+			size_t start = line.find_first_not_of(" \t");
+			if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+				expanded += line + '\n';
+				continue;
+			}
+			size_t open = line.find('"', start), close = open == std::string::npos ? open : line.find('"', open + 1);
+			std::ifstream file;
+			if (close != std::string::npos)
+				file.open((directory + line.substr(open + 1, close - open - 1)).c_str());
+			if (!file.is_open()) {
+				std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND: " << path << ": " << line << std::endl;
+				continue;
+			}
+			std::stringstream included;
+			included << file.rdbuf();
+			expanded += included.str() + '\n';
+		}
+		return expanded;
+	}
+
 	void checkCompileOrLinkingErrors(GLuint shader, std::string type) {
 		GLint state;
 		char* infoLog;
 		GLsizei len;
-		if (type != "PROGRAM") { // /ƬԪɫı
+		if (type != "PROGRAM") { // /ƬԪ/ɫı
 			glGetShaderiv(shader, GL_COMPILE_STATUS, &state);
 			if (!state) {
 				
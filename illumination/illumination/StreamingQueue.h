@@ -0,0 +1,75 @@
+#ifndef STREAMING_QUEUE_H
+#define STREAMING_QUEUE_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+// GL work produced by background loading (texture and buffer uploads), posted from any
+// thread and executed on the GL thread a little at a time, so streaming assets in never
+// costs a frame more than its budget.
+class StreamingQueue {
+public:
+	StreamingQueue() : lastExecuted(0), lastTime(0.0)
+	{ }
+
+	// any thread
+	void post(const std::function<void()> &task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(task);
+	}
+
+	// GL thread, once per frame: runs tasks until the queue is empty or budget (seconds) is spent.
+	// At least one task runs per call so progress is guaranteed even with a tiny budget.
+	unsigned int update(double budget)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		unsigned int executed = 0;
+		double elapsed = 0.0;
+		for (;;)
+		{
+			std::function<void()> task;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (tasks.empty())
+					break;
+				task = tasks.front();
+				tasks.pop_front();
+			}
+			task();
+			executed++;
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (elapsed >= budget)
+				break;
+		}
+		lastExecuted = executed;
+		lastTime = elapsed;
+		return executed;
+	}
+
+	size_t pending()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return tasks.size();
+	}
+
+	// tasks run and seconds spent by the last update()
+	unsigned int getLastExecuted() const
+	{
+		return lastExecuted;
+	}
+	double getLastTime() const
+	{
+		return lastTime;
+	}
+
+private:
+	std::mutex mutex;
+	std::deque<std::function<void()> > tasks;
+	unsigned int lastExecuted;
+	double lastTime;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef TEXTURE_ARRAYS_H
+#define TEXTURE_ARRAYS_H
+
+#include <glad/glad.h>
+
+#include "GLHandle.h"
+#include "GLState.h"
+#include "TextureCompression.h"
+
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Packs texture chains of the same size and format into the layers of GL_TEXTURE_2D_ARRAY
+// textures, so draws using different textures can share one binding and pick their layer in the
+// shader. Each distinct (format, width, height) gets its own array; an array that reaches
+// MAX_LAYERS starts another one. Layers are collected with add() and uploaded together.
+// GL 3.3 has no bindless textures, so this is how draws with different materials are batched.
+class TextureArrays {
+public:
+	// the layer count every GL 3.3 implementation supports
+	static const unsigned int MAX_LAYERS = 256;
+
+	// where a texture ended up; array is -1 for a texture that wasn't added
+	struct Slot {
+		int array;
+		int layer;
+	};
+
+	TextureArrays()
+	{ }
+	TextureArrays(const TextureArrays&) = delete;
+	TextureArrays &operator=(const TextureArrays&) = delete;
+
+	static Slot none()
+	{
+		Slot slot;
+		slot.array = -1;
+		slot.layer = -1;
+		return slot;
+	}
+
+	// reserves a layer for chain; the chain is kept until upload()
+	Slot add(const std::shared_ptr<TextureChain> &chain)
+	{
+		int found = -1;
+		for (unsigned int i = 0; i < arrays.size() && found < 0; i++)
+		{
+			const Array &array = arrays[i];
+			if (array.internalFormat == chain->internalFormat && array.width == chain->width && array.height == chain->height
+				&& array.layers.size() < MAX_LAYERS && !array.texture.get())
+				found = (int)i;
+		}
+		if (found < 0)
+		{
+			Array array;
+			array.internalFormat = chain->internalFormat;
+			array.width = chain->width;
+			array.height = chain->height;
+			array.levels = (int)chain->levels.size();
+			array.bytes = 0;
+			array.layerCount = 0;
+			found = (int)arrays.size();
+			arrays.push_back(std::move(array));
+		}
+		Slot slot;
+		slot.array = found;
+		slot.layer = (int)arrays[found].layers.size();
+		arrays[found].layers.push_back(chain);
+		return slot;
+	}
+
+	// GL thread: creates the arrays added since the last call, uploads their layers and frees the chains
+	void upload()
+	{
+		GLStateCache &state = GLStateCache::get();
+		for (unsigned int i = 0; i < arrays.size(); i++)
+		{
+			Array &array = arrays[i];
+			if (array.texture.get())
+				continue;
+			array.texture = GLTexture::create();
+			state.bindTexture(GL_TEXTURE_2D_ARRAY, array.texture.get());
+			GLsizei layers = (GLsizei)array.layers.size();
+			array.layerCount = layers;
+			for (int level = 0; level < array.levels; level++)
+			{
+				const TextureLevel &first = array.layers[0]->levels[level];
+				if (array.internalFormat == GL_RGBA8)
+					glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, first.width, first.height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				else
+					glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.internalFormat, first.width, first.height, layers, 0,
+						(GLsizei)(first.data.size() * layers), NULL);
+				for (GLsizei layer = 0; layer < layers; layer++)
+				{
+					const TextureLevel &data = array.layers[layer]->levels[level];
+					if (array.internalFormat == GL_RGBA8)
+						glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, data.width, data.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, &data.data[0]);
+					else
+						glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, data.width, data.height, 1, array.internalFormat,
+							(GLsizei)data.data.size(), &data.data[0]);
+				}
+				array.bytes += first.data.size() * layers;
+			}
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, array.levels - 1);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			array.layers.clear();
+		}
+	}
+
+	size_t size() const
+	{
+		return arrays.size();
+	}
+	GLuint getTexture(int array) const
+	{
+		return arrays[array].texture.get();
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		for (unsigned int i = 0; i < arrays.size(); i++)
+		{
+			const Array &array = arrays[i];
+			out << "Texture array " << i << ": " << CompressedFormatName(array.internalFormat) << " " << array.width << "x" << array.height
+				<< ", " << array.layerCount << " layers, " << array.bytes / 1024 << " KB" << std::endl;
+		}
+	}
+
+private:
+	struct Array {
+		GLenum internalFormat;
+		int width, height;
+		int levels;
+		std::vector<std::shared_ptr<TextureChain> > layers; // until uploaded
+		GLTexture texture;
+		size_t bytes;
+		int layerCount;
+	};
+
+	std::vector<Array> arrays;
+};
+
+#endif
@@ -0,0 +1,596 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "GLState.h"
+#include "MipGenerator.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Texture cache. When a model is imported each image gets its full mip chain built on the CPU
+// (MipGenerator) and block-compressed: BC1 for opaque colour, BC3 when there is alpha and BC5 (two
+// channels) for the *_ddn normal maps; without S3TC support colour chains stay RGBA8. The chain is
+// cached on disk next to the source as a KTX 1.1 file, so later runs just read it back and loading
+// is a pure upload. Everything but the GL functions at the bottom is safe to call from any thread.
+
+// S3TC is an extension on GL 3.3 (glad was generated without extensions); RGTC (BC5) is core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// bumped whenever the encoder output changes, so stale cache files are rebuilt
+const unsigned int TEXTURE_ENCODER_VERSION = 2;
+
+struct TextureLevel {
+	int width;
+	int height;
+	std::vector<unsigned char> data;
+};
+
+struct TextureChain {
+	GLenum internalFormat; // a block format, or GL_RGBA8 for an uncompressed chain
+	int width;
+	int height;
+	int sourceComponents; // of the file, for the uncompressed size it would have taken
+	std::string source;   // the file the chain was built from, set by LoadTextureChain
+	std::vector<TextureLevel> levels;
+};
+
+/*  Block encoders  */
+// texels are 4x4 blocks in row-major order
+
+// BC1 colour block (also the colour half of BC3); always emits the four colour mode
+inline void EncodeColorBlock(const unsigned char texels[16][4], unsigned char out[8])
+{
+	// endpoints along the principal axis of the colours
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += texels[i][c];
+	for (int c = 0; c < 3; c++)
+		mean[c] /= 16.0f;
+
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f }; // rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++)
+	{
+		float r = texels[i][0] - mean[0], g = texels[i][1] - mean[1], b = texels[i][2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+		if (length < 1e-6f)
+			break; // flat block, any axis will do
+		axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+	}
+
+	float minT = 1e30f, maxT = -1e30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	// inset by 1/16 of the range: the interpolated colours then cover the extremes better
+	float inset = (maxT - minT) / 16.0f;
+	minT += inset;
+	maxT -= inset;
+
+	unsigned short endpoint[2];
+	for (int e = 0; e < 2; e++)
+	{
+		float t = e == 0 ? maxT : minT;
+		int r = (int)std::min(255.0f, std::max(0.0f, mean[0] + axis[0] * t + 0.5f));
+		int g = (int)std::min(255.0f, std::max(0.0f, mean[1] + axis[1] * t + 0.5f));
+		int b = (int)std::min(255.0f, std::max(0.0f, mean[2] + axis[2] * t + 0.5f));
+		endpoint[e] = (unsigned short)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+	}
+	if (endpoint[0] < endpoint[1])
+		std::swap(endpoint[0], endpoint[1]);
+
+	// palette as the hardware decodes it
+	int palette[4][3];
+	for (int e = 0; e < 2; e++)
+	{
+		int r = endpoint[e] >> 11, g = (endpoint[e] >> 5) & 63, b = endpoint[e] & 31;
+		palette[e][0] = r << 3 | r >> 2;
+		palette[e][1] = g << 2 | g >> 4;
+		palette[e][2] = b << 3 | b >> 2;
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+
+	unsigned int indices = 0;
+	if (endpoint[0] != endpoint[1]) // equal endpoints select the three colour mode, where index 0 is still the colour
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = 1 << 30;
+			for (int p = 0; p < 4; p++)
+			{
+				int dr = texels[i][0] - palette[p][0], dg = texels[i][1] - palette[p][1], db = texels[i][2] - palette[p][2];
+				int error = dr * dr + dg * dg + db * db;
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= (unsigned int)best << (2 * i);
+		}
+	}
+
+	out[0] = endpoint[0] & 0xFF; out[1] = endpoint[0] >> 8;
+	out[2] = endpoint[1] & 0xFF; out[3] = endpoint[1] >> 8;
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// BC4 single channel block: the alpha half of BC3 and each half of BC5
+inline void EncodeChannelBlock(const unsigned char values[16], unsigned char out[8])
+{
+	int low = 255, high = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		low = std::min(low, (int)values[i]);
+		high = std::max(high, (int)values[i]);
+	}
+	out[0] = (unsigned char)high;
+	out[1] = (unsigned char)low;
+
+	// high > low selects the eight value mode
+	int palette[8];
+	palette[0] = high;
+	palette[1] = low;
+	for (int i = 2; i < 8; i++)
+		palette[i] = ((8 - i) * high + (i - 1) * low) / 7;
+
+	unsigned long long indices = 0;
+	if (high != low)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = 1 << 30;
+			for (int p = 0; p < 8; p++)
+			{
+				int error = std::abs((int)values[i] - palette[p]);
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= (unsigned long long)best << (3 * i);
+		}
+	}
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)((indices >> (8 * i)) & 0xFF);
+}
+
+inline size_t CompressedBlockBytes(GLenum internalFormat)
+{
+	return internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+}
+
+inline const char *CompressedFormatName(GLenum internalFormat)
+{
+	if (internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+		return "BC1";
+	if (internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		return "BC3";
+	if (internalFormat == GL_RGBA8)
+		return "RGBA8";
+	return "BC5";
+}
+
+// encodes one RGBA8 image; blocks past the edge of small levels repeat the last row/column
+inline void EncodeLevel(const unsigned char *rgba, int width, int height, GLenum internalFormat, TextureLevel &level)
+{
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	size_t blockBytes = CompressedBlockBytes(internalFormat);
+	level.width = width;
+	level.height = height;
+	level.data.resize(blocksX * blocksY * blockBytes);
+
+	unsigned char *out = &level.data[0];
+	for (int by = 0; by < blocksY; by++)
+	{
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			unsigned char texels[16][4];
+			for (int y = 0; y < 4; y++)
+			{
+				int sy = std::min(by * 4 + y, height - 1);
+				for (int x = 0; x < 4; x++)
+				{
+					int sx = std::min(bx * 4 + x, width - 1);
+					std::memcpy(texels[y * 4 + x], rgba + ((size_t)sy * width + sx) * 4, 4);
+				}
+			}
+
+			if (internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+				EncodeColorBlock(texels, out);
+			else if (internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+			{
+				unsigned char alpha[16];
+				for (int i = 0; i < 16; i++)
+					alpha[i] = texels[i][3];
+				EncodeChannelBlock(alpha, out);
+				EncodeColorBlock(texels, out + 8);
+			}
+			else
+			{
+				unsigned char red[16], green[16];
+				for (int i = 0; i < 16; i++)
+				{
+					red[i] = texels[i][0];
+					green[i] = texels[i][1];
+				}
+				EncodeChannelBlock(red, out);
+				EncodeChannelBlock(green, out + 8);
+			}
+			out += blockBytes;
+		}
+	}
+}
+
+// builds the full mip chain of an RGBA8 image and encodes every level in internalFormat
+inline void BuildTextureChain(const unsigned char *rgba, int width, int height, GLenum internalFormat, Mip_Content content, Mip_Filter filter, TextureChain &chain)
+{
+	chain.internalFormat = internalFormat;
+	chain.width = width;
+	chain.height = height;
+
+	std::vector<MipLevel> mips;
+	GenerateMipChain(rgba, width, height, content, filter, mips);
+	chain.levels.resize(mips.size());
+	for (unsigned int i = 0; i < mips.size(); i++)
+	{
+		if (internalFormat == GL_RGBA8)
+		{
+			chain.levels[i].width = mips[i].width;
+			chain.levels[i].height = mips[i].height;
+			chain.levels[i].data.swap(mips[i].rgba);
+		}
+		else
+			EncodeLevel(&mips[i].rgba[0], mips[i].width, mips[i].height, internalFormat, chain.levels[i]);
+	}
+}
+
+// bytes the image would take uncompressed with a full mip chain, as TextureFromImage uploads it
+inline size_t UncompressedTextureBytes(const TextureChain &image)
+{
+	size_t bytes = 0;
+	for (unsigned int i = 0; i < image.levels.size(); i++)
+		bytes += (size_t)image.levels[i].width * image.levels[i].height * image.sourceComponents;
+	return bytes;
+}
+
+inline size_t CompressedTextureBytes(const TextureChain &image)
+{
+	size_t bytes = 0;
+	for (unsigned int i = 0; i < image.levels.size(); i++)
+		bytes += image.levels[i].data.size();
+	return bytes;
+}
+
+/*  KTX cache  */
+// A KTX 1.1 file. Its key/value data records the source file's size and modification time with the
+// encoder version and mip filter (a mismatch means the cache is stale) and the source's channel count.
+
+// the filter new chains are built with; part of the cache stamp, so changing it rebuilds the cache
+inline std::atomic<int> &TextureMipFilter()
+{
+	static std::atomic<int> filter((int)Mip_Filter::KAISER);
+	return filter;
+}
+
+inline std::string TextureSourceStamp(const std::string &filename)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return std::string();
+	std::ostringstream stamp;
+	stamp << (unsigned long long)info.st_size << ' ' << (unsigned long long)info.st_mtime << ' ' << TEXTURE_ENCODER_VERSION
+		<< ' ' << MipFilterName((Mip_Filter)TextureMipFilter().load());
+	return stamp.str();
+}
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const char KTX_SOURCE_KEY[] = "illumination.source";
+static const char KTX_COMPONENTS_KEY[] = "illumination.components";
+
+inline void WriteUint32(std::ostream &out, unsigned int value)
+{
+	out.write((const char*)&value, 4);
+}
+
+inline void WriteKeyValue(std::ostream &out, const std::string &key, const std::string &value)
+{
+	std::string pair = key + '\0' + value + '\0';
+	WriteUint32(out, (unsigned int)pair.size());
+	out.write(pair.data(), pair.size());
+	out.write("\0\0\0", (4 - pair.size() % 4) % 4);
+}
+
+inline size_t KeyValueBytes(const std::string &key, const std::string &value)
+{
+	size_t bytes = key.size() + value.size() + 2;
+	return 4 + bytes + (4 - bytes % 4) % 4;
+}
+
+inline bool WriteKTX(const std::string &filename, const std::string &stamp, const TextureChain &image)
+{
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	std::string components = std::to_string(image.sourceComponents);
+	bool uncompressed = image.internalFormat == GL_RGBA8;
+	GLenum baseFormat = GL_RGBA;
+	if (image.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+		baseFormat = GL_RGB;
+	else if (image.internalFormat == GL_COMPRESSED_RG_RGTC2)
+		baseFormat = GL_RG;
+
+	file.write((const char*)KTX_IDENTIFIER, 12);
+	WriteUint32(file, 0x04030201);                            // endianness
+	WriteUint32(file, uncompressed ? GL_UNSIGNED_BYTE : 0);   // glType, 0 when compressed
+	WriteUint32(file, 1);                                     // glTypeSize
+	WriteUint32(file, uncompressed ? GL_RGBA : 0);            // glFormat, 0 when compressed
+	WriteUint32(file, image.internalFormat);
+	WriteUint32(file, baseFormat);
+	WriteUint32(file, image.width);
+	WriteUint32(file, image.height);
+	WriteUint32(file, 0);                       // depth
+	WriteUint32(file, 0);                       // array elements
+	WriteUint32(file, 1);                       // faces
+	WriteUint32(file, (unsigned int)image.levels.size());
+	WriteUint32(file, (unsigned int)(KeyValueBytes(KTX_SOURCE_KEY, stamp) + KeyValueBytes(KTX_COMPONENTS_KEY, components)));
+	WriteKeyValue(file, KTX_SOURCE_KEY, stamp);
+	WriteKeyValue(file, KTX_COMPONENTS_KEY, components);
+	// block sizes are multiples of 8 and RGBA8 rows of 4, so levels need no padding
+	for (unsigned int i = 0; i < image.levels.size(); i++)
+	{
+		WriteUint32(file, (unsigned int)image.levels[i].data.size());
+		file.write((const char*)&image.levels[i].data[0], image.levels[i].data.size());
+	}
+	return (bool)file;
+}
+
+// reads a cache file written by WriteKTX; false if it is missing, malformed or not from this source
+inline bool ReadKTX(const std::string &filename, const std::string &stamp, TextureChain &image)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+	std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	size_t offset = 0;
+	struct Reader {
+		const std::vector<unsigned char> &bytes;
+		size_t &offset;
+		bool read(void *out, size_t size)
+		{
+			if (offset + size > bytes.size())
+				return false;
+			std::memcpy(out, &bytes[offset], size);
+			offset += size;
+			return true;
+		}
+	} reader = { bytes, offset };
+
+	unsigned char identifier[12];
+	unsigned int header[13];
+	if (!reader.read(identifier, 12) || std::memcmp(identifier, KTX_IDENTIFIER, 12) != 0 || !reader.read(header, sizeof(header)))
+		return false;
+	if (header[0] != 0x04030201 || header[6] == 0 || header[7] == 0 || header[6] > 65536 || header[7] > 65536 || header[11] == 0)
+		return false;
+	// only the formats the encoder writes, whose level sizes follow from the level's dimensions
+	bool uncompressed = header[1] != 0;
+	if (uncompressed && !(header[1] == GL_UNSIGNED_BYTE && header[4] == GL_RGBA8))
+		return false;
+	if (!uncompressed && header[4] != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && header[4] != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+		&& header[4] != GL_COMPRESSED_RG_RGTC2)
+		return false;
+	image.internalFormat = header[4];
+	image.width = (int)header[6];
+	image.height = (int)header[7];
+	// a full chain down to 1x1 at most
+	unsigned int levelCount = header[11], maxLevels = 1;
+	for (unsigned int size = std::max(header[6], header[7]); size > 1; size /= 2)
+		maxLevels++;
+	if (levelCount > maxLevels)
+		return false;
+	size_t keyValueEnd = offset + header[12];
+	if (keyValueEnd > bytes.size())
+		return false;
+
+	bool fresh = false;
+	image.sourceComponents = 4;
+	while (offset + 4 <= keyValueEnd)
+	{
+		unsigned int size;
+		if (!reader.read(&size, 4) || offset + size > keyValueEnd)
+			return false;
+		std::string pair((const char*)&bytes[offset], size);
+		size_t split = pair.find('\0');
+		std::string key = pair.substr(0, split);
+		std::string value = split == std::string::npos ? std::string() : pair.substr(split + 1, pair.find('\0', split + 1) - split - 1);
+		if (key == KTX_SOURCE_KEY)
+			fresh = value == stamp;
+		else if (key == KTX_COMPONENTS_KEY)
+			image.sourceComponents = std::atoi(value.c_str());
+		offset += size + (4 - size % 4) % 4;
+	}
+	if (!fresh)
+		return false;
+	offset = keyValueEnd;
+
+	image.levels.resize(levelCount);
+	int width = image.width, height = image.height;
+	for (unsigned int i = 0; i < levelCount; i++)
+	{
+		unsigned int size;
+		if (!reader.read(&size, 4))
+			return false;
+		// exactly what the uploads will read
+		size_t expected = uncompressed ? (size_t)width * height * 4
+			: (size_t)((width + 3) / 4) * ((height + 3) / 4) * CompressedBlockBytes(image.internalFormat);
+		if (size != expected)
+			return false;
+		TextureLevel &level = image.levels[i];
+		level.width = width;
+		level.height = height;
+		level.data.resize(size);
+		if (!reader.read(&level.data[0], size))
+			return false;
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	return true;
+}
+
+/*  Loading  */
+
+// whether the GL context can sample S3TC (BC1/BC3); set once by DetectTextureCompression before loading starts
+inline std::atomic<int> &TextureCompressionSupport()
+{
+	static std::atomic<int> support(-1); // -1 not detected: the texture cache is off
+	return support;
+}
+
+// Loads path as a complete mip chain: from its cache file when that is current and in a format the
+// context supports, otherwise by decoding the source, building and encoding the chain and writing the
+// cache. False when the cache is off or the source can't be read; the caller then loads it as before.
+inline bool LoadTextureChain(const char *path, const std::string &directory, TextureChain &image)
+{
+	int support = TextureCompressionSupport().load();
+	if (support < 0)
+		return false;
+
+	std::string filename = directory + '/' + std::string(path);
+	std::string cacheName = filename + ".ktx";
+	std::string stamp = TextureSourceStamp(filename);
+	if (stamp.empty())
+		return false;
+	if (ReadKTX(cacheName, stamp, image))
+	{
+		// a chain cached without S3TC is rebuilt compressed once it is available, and the other way round
+		bool s3tc = image.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || image.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		if (image.internalFormat == GL_COMPRESSED_RG_RGTC2 || s3tc == (support > 0))
+		{
+			image.source = filename;
+			return true;
+		}
+	}
+
+	int width, height, components;
+	unsigned char *rgba = stbi_load(filename.c_str(), &width, &height, &components, 4);
+	if (!rgba)
+		return false;
+
+	// normal maps keep only X and Y, in the two channels of RGTC2
+	Mip_Content content = MipContentForPath(path);
+	GLenum internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	if (content == Mip_Content::NORMAL)
+		internalFormat = GL_COMPRESSED_RG_RGTC2;
+	else if (support == 0)
+		internalFormat = GL_RGBA8;
+	else if (components == 4 || components == 2)
+	{
+		for (size_t i = 0; i < (size_t)width * height; i++)
+		{
+			if (rgba[i * 4 + 3] != 255)
+			{
+				internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+				break;
+			}
+		}
+	}
+
+	image.sourceComponents = components;
+	image.source = filename;
+	BuildTextureChain(rgba, width, height, internalFormat, content, (Mip_Filter)TextureMipFilter().load(), image);
+	stbi_image_free(rgba);
+	if (!WriteKTX(cacheName, stamp, image))
+		std::cout << "Texture cache could not be written: " << cacheName << std::endl;
+	return true;
+}
+
+/*  GL  */
+
+// GL thread, once after the context is created: turns the texture cache on and checks for S3TC
+inline bool DetectTextureCompression()
+{
+	bool s3tc = false;
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+			s3tc = true;
+	}
+	TextureCompressionSupport().store(s3tc ? 1 : 0);
+	if (!s3tc)
+		std::cout << "GL_EXT_texture_compression_s3tc not available: only normal maps are compressed" << std::endl;
+	return s3tc;
+}
+
+inline void ReportTextureCompression(const char *path, const TextureChain &image)
+{
+	std::cout << "Texture " << path << ": " << image.width << "x" << image.height << " " << CompressedFormatName(image.internalFormat)
+		<< ", " << UncompressedTextureBytes(image) / 1024 << " KB -> " << CompressedTextureBytes(image) / 1024 << " KB" << std::endl;
+}
+
+// uploads every level of the chain; no glGenerateMipmap, the levels come from the cache
+inline unsigned int TextureFromChain(const TextureChain &image, const char *path)
+{
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	GLStateCache::get().bindTexture(GL_TEXTURE_2D, textureID);
+	for (unsigned int i = 0; i < image.levels.size(); i++)
+	{
+		const TextureLevel &level = image.levels[i];
+		if (image.internalFormat == GL_RGBA8)
+			glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &level.data[0]);
+		else
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, image.internalFormat, level.width, level.height, 0, (GLsizei)level.data.size(), &level.data[0]);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	ReportTextureCompression(path, image);
+	return textureID;
+}
+
+#endif
@@ -0,0 +1,370 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Material.h"
+#include "StreamingQueue.h"
+#include "TextureCompression.h"
+#include "UploadManager.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Keeps texture memory under a budget by streaming mip levels in and out.
+// The scene pass reports how large each material is on screen (noteUsage, from the recording
+// workers); once per frame update() turns that into the finest level each texture needs, trims
+// the set to the budget by dropping the largest levels first, and applies it:
+// - evicting: GL_TEXTURE_BASE_LEVEL moves up and the levels above it are respecified at 0x0,
+//   which frees their storage (GL 3.3 has no texture views or sparse textures),
+// - streaming in: the chain is read back from the texture cache on a worker and the missing levels
+//   are uploaded through the upload manager; the base level moves down once they are complete.
+// Only textures uploaded from the texture cache (TextureChain) are managed. GL thread only, except
+// noteUsage.
+class TextureResidency {
+public:
+	// frames a texture must be needed at a coarser level before finer levels are dropped
+	static const unsigned int EVICTION_DELAY = 120;
+
+	static TextureResidency &get()
+	{
+		static TextureResidency residency;
+		return residency;
+	}
+
+	// turns the manager on; textures are tracked from the start, but nothing is evicted or streamed
+	// before this. uploads may be NULL.
+	void configure(JobSystem &jobSystem, StreamingQueue &streamingQueue, UploadManager *uploadManager, size_t budgetBytes)
+	{
+		jobs = &jobSystem;
+		streaming = &streamingQueue;
+		uploads = uploadManager;
+		budget = budgetBytes;
+	}
+
+	void setBudget(size_t budgetBytes)
+	{
+		budget = budgetBytes;
+	}
+
+	bool isEnabled() const
+	{
+		return jobs != NULL;
+	}
+
+	// GL thread: starts managing a texture just uploaded with every level of chain
+	void track(GLuint texture, const TextureChain &chain)
+	{
+		if (chain.source.empty() || byTexture.count(texture))
+			return;
+		std::unique_ptr<Record> record(new Record());
+		record->texture = texture;
+		record->internalFormat = chain.internalFormat;
+		record->source = chain.source;
+		record->size = std::max(chain.width, chain.height);
+		for (unsigned int i = 0; i < chain.levels.size(); i++)
+			record->levelBytes.push_back(chain.levels[i].data.size());
+		record->levelCount = (int)chain.levels.size();
+		record->residentBase = 0;
+		record->neededBase = 0;
+		record->desiredBase = 0;
+		record->requested.store(record->levelCount);
+		record->coarserFrames = 0;
+		record->loading = false;
+		record->failed = false;
+		record->released = false;
+		byTexture[texture] = record.get();
+		records.push_back(std::move(record));
+	}
+
+	// GL thread: stops managing a texture that is about to be deleted. Level uploads already handed to
+	// the upload manager are cancelled, since the name may be reused at once. A record whose cache is
+	// still being read back is kept aside until the read lands, and then uploads nothing.
+	void untrack(GLuint texture)
+	{
+		std::unordered_map<GLuint, Record*>::iterator found = byTexture.find(texture);
+		if (found == byTexture.end())
+			return;
+		Record *record = found->second;
+		byTexture.erase(found);
+		// with uploads of it queued, the read has landed: the last of them would have finished the record
+		bool uploading = uploads && uploads->cancel(texture) > 0;
+		for (unsigned int i = 0; i < records.size(); i++)
+		{
+			if (records[i].get() != record)
+				continue;
+			if (record->loading && !uploading)
+			{
+				record->released = true;
+				releasedRecords.push_back(std::move(records[i]));
+			}
+			records.erase(records.begin() + i);
+			break;
+		}
+	}
+
+	// Any thread, while passes are recorded: the textures of material cover about pixels on screen.
+	// Textures the manager doesn't know are ignored; tracking only changes between frames.
+	void noteUsage(const Material *material, float pixels)
+	{
+		if (!material || records.empty())
+			return;
+		for (unsigned int i = 0; i < material->textures.size(); i++)
+		{
+			std::unordered_map<GLuint, Record*>::const_iterator found = byTexture.find(material->textures[i].id);
+			if (found == byTexture.end())
+				continue;
+			Record &record = *found->second;
+			// one texel per pixel: a texture of size s spread over p pixels needs level log2(s / p)
+			int level = (int)std::floor(std::log2(record.size / std::max(pixels, 1.0f)));
+			level = std::max(0, std::min(level, record.levelCount - 1));
+			int current = record.requested.load(std::memory_order_relaxed);
+			while (level < current && !record.requested.compare_exchange_weak(current, level, std::memory_order_relaxed))
+				;
+		}
+	}
+
+	// GL thread, once per frame after the passes have been recorded
+	void update()
+	{
+		if (!isEnabled())
+			return;
+		// 1. the level each texture needs: finer at once, coarser only after EVICTION_DELAY frames
+		for (unsigned int i = 0; i < records.size(); i++)
+		{
+			Record &record = *records[i];
+			int requested = std::min(record.requested.exchange(record.levelCount), record.levelCount - 1);
+			if (requested <= record.neededBase)
+			{
+				record.neededBase = requested;
+				record.coarserFrames = 0;
+			}
+			else if (++record.coarserFrames >= EVICTION_DELAY)
+			{
+				record.neededBase = requested;
+				record.coarserFrames = 0;
+			}
+			record.desiredBase = record.neededBase;
+		}
+
+		// 2. fit the budget: drop the largest finest level until the set fits; the 1x1 level always stays
+		size_t total = 0;
+		for (unsigned int i = 0; i < records.size(); i++)
+			total += records[i]->bytesFrom(records[i]->desiredBase);
+		while (total > budget)
+		{
+			Record *largest = NULL;
+			for (unsigned int i = 0; i < records.size(); i++)
+			{
+				Record *record = records[i].get();
+				if (record->desiredBase < record->levelCount - 1
+					&& (!largest || record->levelBytes[record->desiredBase] > largest->levelBytes[largest->desiredBase]))
+					largest = record;
+			}
+			if (!largest)
+				break;
+			total -= largest->levelBytes[largest->desiredBase];
+			largest->desiredBase++;
+		}
+		targetBytes = total;
+
+		// 3. move every texture towards its level
+		for (unsigned int i = 0; i < records.size(); i++)
+		{
+			Record &record = *records[i];
+			if (record.loading)
+				continue;
+			if (record.desiredBase > record.residentBase)
+				evict(record, record.desiredBase);
+			else if (record.desiredBase < record.residentBase && !record.failed)
+				streamIn(record, record.desiredBase);
+		}
+	}
+
+	// GPU memory of the managed textures as they are now
+	size_t getResidentBytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < records.size(); i++)
+			bytes += records[i]->bytesFrom(records[i]->residentBase);
+		return bytes;
+	}
+
+	void printStats(std::ostream &out) const
+	{
+		size_t full = 0;
+		unsigned int loading = 0, reduced = 0, failed = 0;
+		for (unsigned int i = 0; i < records.size(); i++)
+		{
+			full += records[i]->bytesFrom(0);
+			loading += records[i]->loading ? 1 : 0;
+			reduced += records[i]->residentBase > 0 ? 1 : 0;
+			failed += records[i]->failed ? 1 : 0;
+		}
+		out << "Textures: " << records.size() << " managed, " << getResidentBytes() / 1024 << " KB resident of " << full / 1024
+			<< " KB (target " << targetBytes / 1024 << " KB, budget " << budget / 1024 << " KB), " << reduced << " reduced, "
+			<< loading << " streaming in, " << failed << " with unreadable caches" << std::endl;
+	}
+
+private:
+	struct Record {
+		GLuint texture;
+		GLenum internalFormat;
+		std::string source;           // the image the cache file belongs to
+		int size;                     // largest dimension of level 0
+		int levelCount;
+		std::vector<size_t> levelBytes;
+		int residentBase;             // finest level in GPU memory
+		int neededBase;               // finest level the screen needs, with hysteresis
+		int desiredBase;              // neededBase, coarsened to fit the budget
+		std::atomic<int> requested;   // finest level asked for this frame; levelCount when unused
+		unsigned int coarserFrames;
+		bool loading;                 // finer levels are on their way
+		bool failed;                  // the cache could not be read back, don't retry
+		bool released;                // untracked while its cache was read: in releasedRecords, its texture is gone
+
+		size_t bytesFrom(int base) const
+		{
+			size_t bytes = 0;
+			for (int i = base; i < levelCount; i++)
+				bytes += levelBytes[i];
+			return bytes;
+		}
+	};
+
+	JobSystem *jobs;
+	StreamingQueue *streaming;
+	UploadManager *uploads;
+	size_t budget;
+	size_t targetBytes;
+	std::vector<std::unique_ptr<Record> > records;
+	std::vector<std::unique_ptr<Record> > releasedRecords;
+	std::unordered_map<GLuint, Record*> byTexture;
+
+	TextureResidency() : jobs(NULL), streaming(NULL), uploads(NULL), budget(0), targetBytes(0)
+	{ }
+	TextureResidency(const TextureResidency&) = delete;
+	TextureResidency &operator=(const TextureResidency&) = delete;
+
+	// frees the levels finer than base
+	void evict(Record &record, int base)
+	{
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, record.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+		for (int level = record.residentBase; level < base; level++)
+		{
+			if (record.internalFormat == GL_RGBA8)
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			else
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, record.internalFormat, 0, 0, 0, 0, NULL);
+		}
+		record.residentBase = base;
+	}
+
+	// reads the chain back on a worker and uploads levels base .. residentBase - 1
+	void streamIn(Record &record, int base)
+	{
+		record.loading = true;
+		Record *target = &record;
+		StreamingQueue *queue = streaming;
+		UploadManager *uploadManager = uploads;
+		std::string source = record.source;
+		jobs->run([target, queue, uploadManager, source, base]() {
+			std::shared_ptr<TextureChain> chain(new TextureChain());
+			bool read = ReadKTX(source + ".ktx", TextureSourceStamp(source), *chain);
+			queue->post([target, uploadManager, chain, read, base]() {
+				if (target->released)
+				{
+					TextureResidency::get().dropReleased(target);
+					return;
+				}
+				if (!read || (int)chain->levels.size() != target->levelCount)
+				{
+					// once per texture: a failed record is never streamed in again
+					std::cout << "ERROR::TEXTURE_RESIDENCY:: cache of " << target->source << " could not be read, keeping its resident levels" << std::endl;
+					target->failed = true;
+					target->loading = false;
+					return;
+				}
+				int end = target->residentBase;
+				for (int level = base; level < end; level++)
+				{
+					const TextureLevel &data = chain->levels[level];
+					std::function<void()> done;
+					if (level == end - 1)
+						done = [target, base]() { TextureResidency::get().streamedIn(*target, base); };
+					if (!uploadManager)
+					{
+						GLStateCache::get().bindTexture(GL_TEXTURE_2D, target->texture);
+						if (target->internalFormat == GL_RGBA8)
+							glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, data.width, data.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &data.data[0]);
+						else
+							glCompressedTexImage2D(GL_TEXTURE_2D, level, target->internalFormat, data.width, data.height, 0, (GLsizei)data.data.size(), &data.data[0]);
+						if (done)
+							done();
+					}
+					else
+					{
+						std::shared_ptr<const unsigned char> bytes(chain, &data.data[0]);
+						if (target->internalFormat == GL_RGBA8)
+							uploadManager->uploadTexture(target->texture, level, GL_RGBA8, data.width, data.height, GL_RGBA, GL_UNSIGNED_BYTE, 4, bytes, false, done);
+						else
+							uploadManager->uploadCompressedTexture(target->texture, level, target->internalFormat, data.width, data.height, data.data.size(), bytes, done);
+					}
+				}
+			});
+		});
+	}
+
+	// every level from base down is uploaded: sample from base
+	void streamedIn(Record &record, int base)
+	{
+		if (record.released)
+		{
+			dropReleased(&record);
+			return;
+		}
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, record.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+		record.residentBase = base;
+		record.loading = false;
+	}
+
+	// the in-flight work of an untracked record is over
+	void dropReleased(Record *record)
+	{
+		for (unsigned int i = 0; i < releasedRecords.size(); i++)
+		{
+			if (releasedRecords[i].get() == record)
+			{
+				releasedRecords.erase(releasedRecords.begin() + i);
+				return;
+			}
+		}
+	}
+};
+
+// screen height in pixels covered by a bounding box seen through view and projection
+inline float ProjectedPixels(const AABB &worldBounds, const glm::mat4 &view, const glm::mat4 &projection, float viewportHeight)
+{
+	glm::vec3 extent = worldBounds.getExtent();
+	float diameter = 2.0f * std::sqrt(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z);
+	float scale = projection[1][1] * 0.5f * viewportHeight;
+	if (projection[2][3] == 0.0f) // orthographic
+		return diameter * scale;
+	glm::vec4 center = view * glm::vec4(worldBounds.getCenter(), 1.0f);
+	return diameter * scale / std::max(-center.z, 0.1f);
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef UPLOAD_MANAGER_H
+#define UPLOAD_MANAGER_H
+
+#include <glad/glad.h>
+
+#include "GLHandle.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+
+// Spreads texture and buffer uploads over frames. Data is copied into a staging ring buffer and
+// transferred from there by the GPU: glTexSubImage2D from a pixel unpack buffer for textures,
+// glCopyBufferSubData for buffers. update() moves at most the per-frame byte budget, so large
+// assets are split into row bands (block rows for compressed textures) or byte ranges across frames.
+// Each frame's staging range is protected by a fence and only reused once the fence has
+// signalled, so the ring is written with unsynchronized mappings and never waits on the GPU.
+// If the ring is full, uploads simply resume next frame.
+// GL thread only.
+class UploadManager {
+public:
+	UploadManager(size_t ringSize = 16 << 20, size_t bytesPerFrame = 4 << 20)
+		: ringSize(ringSize), bytesPerFrame(bytesPerFrame), head(0), used(0), lastFrameBytes(0), totalBytes(0)
+	{
+		ring = GLBuffer::create();
+		glBindBuffer(GL_COPY_READ_BUFFER, ring.get());
+		glBufferData(GL_COPY_READ_BUFFER, ringSize, NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	~UploadManager()
+	{
+		for (unsigned int i = 0; i < frames.size(); i++)
+			glDeleteSync(frames[i].fence);
+	}
+
+	void setBytesPerFrame(size_t bytes)
+	{
+		bytesPerFrame = bytes;
+	}
+
+	// Fills one level of texture, which is allocated here, from tightly packed pixels. done runs once the
+	// last band has been issued, at once if there is none; draws after that see the data. pixels must
+	// stay valid until then, which the shared pointer guarantees. mipmaps generates the levels below from
+	// this one when it is done.
+	void uploadTexture(GLuint texture, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLenum format, GLenum type,
+		size_t bytesPerPixel, const std::shared_ptr<const unsigned char> &pixels, bool mipmaps, const std::function<void()> &done)
+	{
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, type, NULL);
+		if ((size_t)width * bytesPerPixel * height == 0)
+		{
+			finishEmpty(done);
+			return;
+		}
+
+		Request request;
+		request.kind = Request::TEXTURE;
+		request.target = texture;
+		request.level = level;
+		request.format = format;
+		request.type = type;
+		request.width = width;
+		request.height = height;
+		request.rowBytes = (size_t)width * bytesPerPixel;
+		request.size = request.rowBytes * height;
+		request.offset = 0;
+		request.mipmaps = mipmaps;
+		request.data = pixels;
+		request.done = done;
+		requests.push_back(request);
+	}
+
+	// Fills one level of a block-compressed texture, allocated here, from size bytes of blocks. Bands are
+	// whole rows of 4x4 blocks spanning the full width.
+	void uploadCompressedTexture(GLuint texture, GLint level, GLenum internalFormat, GLsizei width, GLsizei height,
+		size_t size, const std::shared_ptr<const unsigned char> &blocks, const std::function<void()> &done)
+	{
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D, texture);
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, (GLsizei)size, NULL);
+		if (size == 0)
+		{
+			finishEmpty(done);
+			return;
+		}
+
+		Request request;
+		request.kind = Request::COMPRESSED_TEXTURE;
+		request.target = texture;
+		request.level = level;
+		request.format = internalFormat;
+		request.width = width;
+		request.height = height;
+		request.rowBytes = size / ((height + 3) / 4);
+		request.size = size;
+		request.offset = 0;
+		request.mipmaps = false;
+		request.data = blocks;
+		request.done = done;
+		requests.push_back(request);
+	}
+
+	// Fills size bytes of buffer, already allocated (e.g. glBufferData with NULL), starting at offset.
+	void uploadBuffer(GLuint buffer, GLintptr offset, size_t size, const std::shared_ptr<const unsigned char> &data, const std::function<void()> &done)
+	{
+		if (size == 0)
+		{
+			finishEmpty(done);
+			return;
+		}
+		Request request;
+		request.kind = Request::BUFFER;
+		request.target = buffer;
+		request.destination = offset;
+		request.size = size;
+		request.offset = 0;
+		request.rowBytes = 1;
+		request.mipmaps = false;
+		request.data = data;
+		request.done = done;
+		requests.push_back(request);
+	}
+
+	// Drops every request still filling texture, without running their done, for a texture about to be
+	// deleted: GL hands the name out again, and the rest would land in the next texture to get it.
+	// Returns how many were dropped.
+	size_t cancel(GLuint texture)
+	{
+		size_t dropped = 0;
+		for (std::deque<Request>::iterator i = requests.begin(); i != requests.end(); )
+		{
+			if (i->kind != Request::BUFFER && i->target == texture)
+			{
+				i = requests.erase(i);
+				dropped++;
+			}
+			else
+				i++;
+		}
+		return dropped;
+	}
+
+	// once per frame: recycles staging memory the GPU is done with and issues up to the budget
+	void update()
+	{
+		retireFrames();
+
+		size_t frameBytes = 0, staged = 0;
+		while (!requests.empty() && staged < bytesPerFrame)
+		{
+			Request &request = requests.front();
+			size_t remaining = request.size - request.offset;
+			// whole rows for textures; always at least one so a tiny budget still makes progress
+			size_t chunk = std::min(remaining, std::max(bytesPerFrame - staged, request.rowBytes));
+			chunk = std::min(chunk, ringSize);
+			chunk -= chunk % request.rowBytes;
+
+			size_t start, consumed;
+			if (!allocate(chunk, start, consumed))
+				break; // ring full, the GPU hasn't caught up yet
+
+			glBindBuffer(GL_COPY_READ_BUFFER, ring.get());
+			void *mapped = glMapBufferRange(GL_COPY_READ_BUFFER, start, chunk, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			if (!mapped)
+			{
+				glBindBuffer(GL_COPY_READ_BUFFER, 0);
+				std::cout << "ERROR::UPLOAD:: staging buffer could not be mapped" << std::endl;
+				break;
+			}
+			std::memcpy(mapped, request.data.get() + request.offset, chunk);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+
+			if (request.kind == Request::TEXTURE)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.get());
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				GLStateCache::get().bindTexture(GL_TEXTURE_2D, request.target);
+				GLint firstRow = (GLint)(request.offset / request.rowBytes);
+				glTexSubImage2D(GL_TEXTURE_2D, request.level, 0, firstRow, request.width, (GLsizei)(chunk / request.rowBytes), request.format, request.type, (void*)start);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				// client-memory uploads elsewhere must not see the unpack buffer
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			else if (request.kind == Request::COMPRESSED_TEXTURE)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.get());
+				GLStateCache::get().bindTexture(GL_TEXTURE_2D, request.target);
+				GLint y = (GLint)(request.offset / request.rowBytes) * 4;
+				GLsizei rows = std::min((GLsizei)(chunk / request.rowBytes) * 4, request.height - y);
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, request.level, 0, y, request.width, rows, request.format, (GLsizei)chunk, (void*)start);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			else
+			{
+				glBindBuffer(GL_COPY_WRITE_BUFFER, request.target);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, start, request.destination + request.offset, chunk);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			}
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+			request.offset += chunk;
+			staged += chunk;
+			frameBytes += consumed;
+			if (request.offset == request.size)
+			{
+				// popped before done runs: it may queue more uploads
+				Request finished = request;
+				requests.pop_front();
+				if (finished.kind == Request::TEXTURE && finished.mipmaps)
+				{
+					GLStateCache::get().bindTexture(GL_TEXTURE_2D, finished.target);
+					glGenerateMipmap(GL_TEXTURE_2D);
+				}
+				if (finished.done)
+					finished.done();
+			}
+		}
+
+		if (frameBytes > 0)
+		{
+			StagingFrame frame;
+			frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			frame.bytes = frameBytes;
+			frames.push_back(frame);
+		}
+		lastFrameBytes = staged;
+		totalBytes += staged;
+	}
+
+	size_t pendingUploads() const
+	{
+		return requests.size();
+	}
+	// bytes still to be staged
+	size_t pendingBytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < requests.size(); i++)
+			bytes += requests[i].size - requests[i].offset;
+		return bytes;
+	}
+	size_t getLastFrameBytes() const
+	{
+		return lastFrameBytes;
+	}
+	size_t getTotalBytes() const
+	{
+		return totalBytes;
+	}
+	// staging memory still owned by the GPU
+	size_t getRingUsed() const
+	{
+		return used;
+	}
+
+private:
+	struct Request {
+		enum Kind { TEXTURE, COMPRESSED_TEXTURE, BUFFER } kind;
+		GLuint target;           // texture or buffer name
+		GLint level;             // textures
+		GLenum format, type;     // textures; format is the internal format of compressed ones
+		GLsizei width, height;   // textures
+		GLintptr destination;    // buffers: offset in the destination
+		size_t rowBytes;         // granularity of a chunk
+		size_t size;             // bytes in total
+		size_t offset;           // bytes already staged
+		bool mipmaps;
+		std::shared_ptr<const unsigned char> data;
+		std::function<void()> done;
+	};
+
+	// staging memory written during one frame, free again once its fence signals
+	struct StagingFrame {
+		GLsync fence;
+		size_t bytes;
+	};
+
+	static const size_t ALIGNMENT = 64;
+
+	GLBuffer ring;
+	size_t ringSize;
+	size_t bytesPerFrame;
+	size_t head; // next free byte
+	size_t used; // bytes between the oldest unretired frame and head, including skipped ring ends
+	std::deque<Request> requests;
+	std::deque<StagingFrame> frames;
+	size_t lastFrameBytes;
+	size_t totalBytes;
+
+	// an empty request has nothing to stage: queued, it would map a zero-length range, which fails, and
+	// hold up everything behind it
+	static void finishEmpty(const std::function<void()> &done)
+	{
+		if (done)
+			done();
+	}
+
+	void retireFrames()
+	{
+		while (!frames.empty())
+		{
+			GLenum status = glClientWaitSync(frames.front().fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(frames.front().fence);
+			used -= frames.front().bytes;
+			frames.pop_front();
+		}
+		if (frames.empty())
+			head = used = 0;
+	}
+
+	// reserves size contiguous bytes; consumed includes alignment padding and a skipped ring end
+	bool allocate(size_t size, size_t &start, size_t &consumed)
+	{
+		size_t aligned = (head + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		if (aligned + size > ringSize)
+			aligned = 0; // wrap; the tail end of the ring is skipped
+		consumed = (aligned >= head ? aligned - head : ringSize - head) + size;
+		if (size > ringSize || used + consumed > ringSize)
+			return false;
+		start = aligned;
+		head = aligned + size;
+		used += consumed;
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,50 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+flat in ivec4 Layers;
+
+uniform vec3 viewPos;
+
+// same lighting as sofa.fs, with the maps taken from texture arrays
+uniform sampler2DArray diffuseArray;
+uniform sampler2DArray specularArray;
+
+struct Light {
+    vec3 position;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+uniform Light light;
+
+#include "clustered_lights.glsl"
+
+void main()
+{
+    vec3 diffuseColor = Layers.x >= 0 ? texture(diffuseArray, vec3(TexCoords, Layers.x)).rgb : vec3(0.0);
+    vec3 specularColor = Layers.y >= 0 ? texture(specularArray, vec3(TexCoords, Layers.y)).rgb : vec3(0.0);
+
+	// ambient
+    vec3 ambient = light.ambient * diffuseColor;
+  	
+    // diffuse 
+    vec3 norm = normalize(Normal);
+    vec3 lightDir = normalize(light.position - FragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    
+    // specular
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);  
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = light.specular * spec * specularColor;
+        
+    vec3 result = ambient + diffuse + specular;
+    result += ClusteredLighting(FragPos, norm, viewDir, diffuseColor, specularColor, 32.0);
+    FragColor = vec4(result, 1.0);
+}
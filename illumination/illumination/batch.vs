@@ -0,0 +1,28 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in uint aMaterial;
+
+invariant gl_Position;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+flat out ivec4 Layers;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// per material: diffuse and specular layer in their texture arrays, -1 when the material has none
+uniform ivec4 materialLayers[64];
+
+void main()
+{
+    TexCoords = aTexCoords;
+    Layers = materialLayers[aMaterial];
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+	Normal = mat3(transpose(inverse(model))) * aNormal;
+	FragPos = vec3(model * vec4(aPos, 1.0));
+}
@@ -0,0 +1,41 @@
+// Clustered point lights (ClusteredLights.h). Included by the fragment shaders of the scene;
+// ClusteredLighting returns the light of every point light whose sphere reaches the fragment's cluster.
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+
+uniform samplerBuffer clusterLights;   // per light: (position, radius), (colour, 0)
+uniform usamplerBuffer clusterGrid;    // per cluster: (first index, light count)
+uniform usamplerBuffer clusterIndices; // light indices, cluster after cluster
+uniform float clusterNear;
+uniform float clusterSliceScale;       // CLUSTERS_Z / log(far / near)
+uniform vec3 clusterTileSize;          // pixels per tile in x and y
+uniform mat4 view;
+
+vec3 ClusteredLighting(vec3 fragPos, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess)
+{
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int slice = clamp(int(log(max(depth, clusterNear) / clusterNear) * clusterSliceScale), 0, CLUSTERS_Z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterTileSize.xy), ivec2(0), ivec2(CLUSTERS_X - 1, CLUSTERS_Y - 1));
+    uvec2 range = texelFetch(clusterGrid, (slice * CLUSTERS_Y + tile.y) * CLUSTERS_X + tile.x).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(clusterLights, light * 2);
+        vec3 color = texelFetch(clusterLights, light * 2 + 1).rgb;
+
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        // inverse square falloff, windowed to reach zero at the radius
+        float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+
+        vec3 lightDir = toLight / max(distance, 0.0001);
+        float diff = max(dot(normal, lightDir), 0.0);
+        float spec = pow(max(dot(viewDir, reflect(-lightDir, normal)), 0.0), shininess);
+        result += color * attenuation * (diff * diffuseColor + spec * specularColor);
+    }
+    return result;
+}
@@ -0,0 +1,81 @@
+#version 330 core
+out vec4 FragColor;
+
+// the G-buffer (gbuffer.glsl) and its depth
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormalShininess;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+uniform vec3 viewPos;
+uniform mat4 lightSpaceMatrix;
+uniform bool shadows;
+
+struct Light {
+    vec3 position;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+uniform Light light;
+
+#include "shadow_mapping.glsl"
+#include "clustered_lights.glsl"
+
+// inverse of EncodeNormal in gbuffer.glsl
+vec3 DecodeNormal(vec2 encoded)
+{
+    vec2 e = encoded * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+// the lamp and the clustered point lights, as the forward shaders light them
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, texel, 0).r;
+    if (depth == 1.0)
+        discard; // nothing drawn here: keep the clear colour
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, texel, 0);
+    vec4 normalShininess = texelFetch(gNormalShininess, texel, 0);
+    int flags = int(normalShininess.a * 3.0 + 0.5); // GBUFFER_SHADOWED = 1, GBUFFER_UNLIT = 2
+    vec3 albedo = albedoSpecular.rgb;
+    if ((flags & 2) != 0)
+    {
+        FragColor = vec4(albedo, 1.0);
+        return;
+    }
+
+    // world position from depth
+    vec3 ndc = vec3(gl_FragCoord.xy / vec2(textureSize(gDepth, 0)), depth) * 2.0 - 1.0;
+    vec4 world = inverseViewProjection * vec4(ndc, 1.0);
+    vec3 fragPos = world.xyz / world.w;
+    vec3 norm = DecodeNormal(normalShininess.xy);
+    vec3 specularColor = vec3(albedoSpecular.a);
+    float shininess = max(normalShininess.z * 256.0, 1.0);
+
+    // ambient
+    vec3 ambient = light.ambient * albedo;
+
+    // diffuse
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diff * albedo;
+
+    // specular
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = light.specular * spec * specularColor;
+
+    float shadow = shadows && (flags & 1) != 0 ? ShadowCalculation(lightSpaceMatrix * vec4(fragPos, 1.0), fragPos, light.position, norm, lightDir) : 0.0;
+    shadow = min(shadow, 0.75); // as in object.fs
+    vec3 result = ambient + (1.0 - shadow) * (diffuse + specular);
+    result += ClusteredLighting(fragPos, norm, viewDir, albedo, specularColor, shininess);
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+// --depth-prepass: depth of the scene's SOLID objects before they are shaded with GL_EQUAL. The
+// position is computed exactly as in the scene's vertex shaders, all invariant, so both passes
+// produce the same depth bit for bit.
+layout (location = 0) in vec3 position;
+
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(position, 1.0);
+}
@@ -0,0 +1,24 @@
+// Compact G-buffer of the deferred path (DeferredRenderer.h), 8 bytes of colour per pixel:
+// - gAlbedoSpecular  RGBA8:    albedo, specular intensity
+// - gNormalShininess RGB10_A2: octahedral normal, shininess / 256, flags (GBUFFER_SHADOWED, GBUFFER_UNLIT)
+// Positions aren't stored; deferred_lighting.fs rebuilds them from the depth buffer.
+layout (location = 0) out vec4 gAlbedoSpecular;
+layout (location = 1) out vec4 gNormalShininess;
+
+const int GBUFFER_SHADOWED = 1; // receives the lamp's shadow
+const int GBUFFER_UNLIT = 2;    // albedo is the final colour
+
+// unit normal to [0,1]^2: octahedron projection, lower half folded over the upper one
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return (n.z >= 0.0 ? n.xy : folded) * 0.5 + 0.5;
+}
+
+// the specular colour is kept as one intensity
+void WriteGBuffer(vec3 albedo, vec3 specular, float shininess, vec3 normal, int flags)
+{
+    gAlbedoSpecular = vec4(albedo, dot(specular, vec3(1.0 / 3.0)));
+    gNormalShininess = vec4(EncodeNormal(normalize(normal)), clamp(shininess / 256.0, 0.0, 1.0), float(flags) / 3.0);
+}
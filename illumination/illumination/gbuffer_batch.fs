@@ -0,0 +1,18 @@
+#version 330 core
+// G-buffer pass of the batched model, with batch.vs; lit in deferred_lighting.fs like batch.fs
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+flat in ivec4 Layers;
+
+uniform sampler2DArray diffuseArray;
+uniform sampler2DArray specularArray;
+
+#include "gbuffer.glsl"
+
+void main()
+{
+    vec3 diffuseColor = Layers.x >= 0 ? texture(diffuseArray, vec3(TexCoords, Layers.x)).rgb : vec3(0.0);
+    vec3 specularColor = Layers.y >= 0 ? texture(specularArray, vec3(TexCoords, Layers.y)).rgb : vec3(0.0);
+    WriteGBuffer(diffuseColor, specularColor, 32.0, Normal, 0);
+}
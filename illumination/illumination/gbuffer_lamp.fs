@@ -0,0 +1,8 @@
+#version 330 core
+// G-buffer pass of the lamp, with lamp.vs: plain white like lamp.fs
+#include "gbuffer.glsl"
+
+void main()
+{
+    WriteGBuffer(vec3(1.0), vec3(0.0), 1.0, vec3(0.0, 0.0, 1.0), GBUFFER_UNLIT);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+// G-buffer pass of the room, with object.vs; lit in deferred_lighting.fs like object.fs
+in vec3 FragPos;
+in vec3 Normal;
+
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+uniform Material material;
+
+#include "gbuffer.glsl"
+
+void main()
+{
+    WriteGBuffer(material.diffuse, material.specular, material.shininess, Normal, GBUFFER_SHADOWED);
+}
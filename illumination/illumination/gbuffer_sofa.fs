@@ -0,0 +1,15 @@
+#version 330 core
+// G-buffer pass of the model, with sofa.vs; lit in deferred_lighting.fs like sofa.fs
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+
+uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_specular1;
+
+#include "gbuffer.glsl"
+
+void main()
+{
+    WriteGBuffer(texture(texture_diffuse1, TexCoords).rgb, texture(texture_specular1, TexCoords).rgb, 32.0, Normal, 0);
+}
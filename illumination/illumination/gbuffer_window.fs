@@ -0,0 +1,20 @@
+#version 330 core
+// G-buffer pass of the window, with window.vs; lit in deferred_lighting.fs like window.fs
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+struct Material {
+    sampler2D diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+uniform Material material;
+
+#include "gbuffer.glsl"
+
+void main()
+{
+    WriteGBuffer(texture(material.diffuse, TexCoords).rgb, material.specular, material.shininess, Normal, 0);
+}
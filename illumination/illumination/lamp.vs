@@ -1,6 +1,8 @@
 #version 330 core
 layout (location = 0) in vec3 vPosition;
 
+invariant gl_Position;
+
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
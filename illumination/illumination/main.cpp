@@ -5,11 +5,57 @@
 #include "shader.h"
 #include "Camera.h"
 #include "Model.h"
+#include "GLState.h"
+#include "Material.h"
+#include "RenderQueue.h"
+#include "Renderable.h"
+#include "JobSystem.h"
+#include "Benchmarks.h"
+#include "StreamingQueue.h"
+#include "UploadManager.h"
+#include "TextureResidency.h"
+#include "ModelBatch.h"
+#include "ClusteredLights.h"
+#include "DeferredRenderer.h"
+#include "GpuTimer.h"
+#include "MomentShadowMap.h"
+#include "OcclusionQueries.h"
+#include "SceneFile.h"
+#include "SceneGraph.h"
+
+#include <cstring>
 
 #include <iostream>
 
 #define BUFFER_OFFSET(offset) ((void *)(offset))
 
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+// heap allocations are counted for --bench-import while an AllocationCount lives on the thread (Benchmarks.h)
+thread_local AllocationCount *AllocationCount::current = NULL;
+
+void *operator new(size_t size)
+{
+	AllocationCount::counted();
+	void *memory = std::malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+	std::free(memory);
+}
+#endif
+
 void RenderQuad();
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
@@ -18,15 +64,29 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path);
+DrawItem arrayDrawItem(const Shader &shader, const Material *material, GLuint vao, GLsizei count, const glm::mat4 &model);
 
 // settings
 const unsigned int SCR_WIDTH = 1200;
 const unsigned int SCR_HEIGHT = 900;
+// seconds per frame the GL thread may spend uploading streamed assets
+const double STREAMING_BUDGET = 0.002;
+// bytes per frame the upload manager may stage for streamed textures and vertex data
+const size_t UPLOAD_BUDGET = 4 << 20;
+// GPU memory the mip levels of cached textures may take; the finest levels beyond it are streamed out
+const size_t TEXTURE_BUDGET = 48 << 20;
+// dynamic point lights of the clustered lighting, on top of the shadowed lamp
+const unsigned int SCENE_LIGHTS = 128;
+// --evsm: c in the moments exp(c d), exp(2 c d) of the lamp's depth d in [0, 1]; exp(2c) must fit a float
+const float EVSM_EXPONENT = 40.0f;
+// PCF kernels, in the order of SHADOW_KERNEL_* in shadow_mapping.glsl, and their fetches
+const char *const SHADOW_KERNEL_NAMES[3] = { "grid", "poisson", "rotated" };
+const int SHADOW_KERNEL_FETCHES[3] = { 9, 8, 4 };
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), Projection_Type::PERSPECTIVE);
 
-// lamp
+// lamp; moved to the scene file's first light once it is loaded
 glm::vec3 lampPos(0.0f, 3.5f, 0.1f);
 
 bool mousePressed = false;
@@ -38,8 +98,114 @@ float lastY = 900.0 / 2.0;
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
 
-int main()
+int main(int argc, char **argv)
 {
+	// command-line benchmarks run without opening a window
+	if (argc > 1 && std::strcmp(argv[1], "--bench-jobs") == 0)
+		return RunJobSystemBenchmark("nanosuit/nanosuit.obj");
+	if (argc > 1 && std::strcmp(argv[1], "--bench-lights") == 0)
+		return RunClusteredLightsBenchmark();
+	if (argc > 1 && std::strcmp(argv[1], "--bench-occlusion") == 0)
+		return RunOcclusionBenchmark();
+	if (argc > 1 && std::strcmp(argv[1], "--bench-entities") == 0)
+		return RunEntityBenchmark();
+	if (argc > 1 && std::strcmp(argv[1], "--bench-import") == 0)
+		return RunImportBenchmark(argc > 2 ? argv[2] : "nanosuit/nanosuit.obj");
+	// --compile-scene in out: compiles a scene file into the binary form --scene loads with one read
+	if (argc > 3 && std::strcmp(argv[1], "--compile-scene") == 0)
+	{
+		SceneFile compiled;
+		return compiled.load(argv[2]) && compiled.saveBinary(argv[3]) ? 0 : -1;
+	}
+	std::string scenePath = "scene.txt";
+	bool batchModel = false, deferredShading = false, omniShadows = true, evsmShadows = false;
+	bool depthPrepass = false, occlusionCulling = true, gpuOcclusion = false, showStats = false;
+	int shadowKernel = 2; // SHADOW_KERNEL_* of shadow_mapping.glsl
+	Geometry_Retention keepGeometry = Geometry_Retention::DISCARD;
+	for (int i = 1; i < argc; i++)
+	{
+		// --batch: once loaded, the model is drawn from texture arrays and one vertex buffer, with one
+		// multi-draw per set of arrays instead of a draw per mesh
+		if (std::strcmp(argv[i], "--batch") == 0)
+			batchModel = true;
+		// --deferred: the scene is written to a G-buffer and lit in one full-screen pass
+		else if (std::strcmp(argv[i], "--deferred") == 0)
+			deferredShading = true;
+		// --spot-shadows: the lamp's shadow from one 90 degree depth map looking at the origin instead of a cube map
+		else if (std::strcmp(argv[i], "--spot-shadows") == 0)
+			omniShadows = false;
+		// --evsm: the cube shadow is filtered from blurred, mipmapped moments instead of PCF
+		else if (std::strcmp(argv[i], "--evsm") == 0)
+			evsmShadows = true;
+		// --depth-prepass: the forward pass lays down depth first and shades only the visible fragments
+		else if (std::strcmp(argv[i], "--depth-prepass") == 0)
+			depthPrepass = true;
+		// --no-occlusion: objects hidden behind the room's walls are drawn anyway
+		else if (std::strcmp(argv[i], "--no-occlusion") == 0)
+			occlusionCulling = false;
+		// --gpu-occlusion: the model's meshes are culled with occlusion queries on their boxes instead
+		else if (std::strcmp(argv[i], "--gpu-occlusion") == 0)
+			gpuOcclusion = true;
+		// --keep-geometry none|positions|all: what the model's meshes keep on the CPU once uploaded
+		else if (std::strcmp(argv[i], "--keep-geometry") == 0 && i + 1 < argc)
+		{
+			i++;
+			for (int retention = 0; retention < 3; retention++)
+				if (std::strcmp(argv[i], GEOMETRY_RETENTION_NAMES[retention]) == 0)
+					keepGeometry = (Geometry_Retention)retention;
+		}
+		// --stats: GL state, draw, culling, GPU time and streaming statistics, printed once per second
+		else if (std::strcmp(argv[i], "--stats") == 0)
+			showStats = true;
+		// --scene file: the scene to show, as text or compiled (.bin)
+		else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+			scenePath = argv[++i];
+		// --shadow-kernel grid|poisson|rotated: the PCF kernel of shadow_mapping.glsl
+		else if (std::strcmp(argv[i], "--shadow-kernel") == 0 && i + 1 < argc)
+		{
+			i++;
+			for (int kernel = 0; kernel < 3; kernel++)
+				if (std::strcmp(argv[i], SHADOW_KERNEL_NAMES[kernel]) == 0)
+					shadowKernel = kernel;
+		}
+	}
+	evsmShadows = evsmShadows && omniShadows;
+	depthPrepass = depthPrepass && !deferredShading; // the G-buffer pass shades nothing
+	occlusionCulling = occlusionCulling && !gpuOcclusion;
+
+	// the objects, materials and light, before anything is created for them
+	SceneFile scene;
+	if (!scene.load(scenePath))
+		return -1;
+	scene.printStats(std::cout);
+	// the first object of each built-in shape gives its shader the material; the model is the first asset
+	int roomObject = -1, windowObject = -1, modelObject = -1;
+	for (unsigned int i = 0; i < scene.getObjectCount(); i++)
+	{
+		std::string shape = scene.getObject(i).shape.pointer;
+		int &first = shape == "room" ? roomObject : shape == "window" ? windowObject : modelObject;
+		if (shape == "model" && modelObject >= 0)
+			std::cout << "ERROR::SCENE:: only one model per scene, " << scene.getObject(i).name.pointer << " is ignored" << std::endl;
+		else if (first < 0 && (shape == "room" || shape == "window" || shape == "model"))
+			first = (int)i;
+	}
+	if (modelObject < 0)
+	{
+		std::cout << "ERROR::SCENE:: " << scenePath << " has no model object" << std::endl;
+		return -1;
+	}
+	const SceneMaterial &roomSurface = scene.getMaterial(roomObject >= 0 ? scene.getObject(roomObject).material : -1);
+	const SceneMaterial &windowSurface = scene.getMaterial(windowObject >= 0 ? scene.getObject(windowObject).material : -1);
+	glm::vec3 lightAmbient(0.2f), lightDiffuse(0.5f), lightSpecular(1.0f);
+	if (scene.getLightCount() > 0)
+	{
+		const SceneLight &light = scene.getLight(0);
+		lampPos = glm::vec3(light.position[0], light.position[1], light.position[2]);
+		lightAmbient = glm::vec3(light.ambient[0], light.ambient[1], light.ambient[2]);
+		lightDiffuse = glm::vec3(light.diffuse[0], light.diffuse[1], light.diffuse[2]);
+		lightSpecular = glm::vec3(light.specular[0], light.specular[1], light.specular[2]);
+	}
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
@@ -74,11 +240,26 @@ int main()
 	// configure global opengl state
 	// -----------------------------
 	glEnable(GL_DEPTH_TEST);
+	// filtered cube map lookups blend across face edges
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	// textures loaded from here on are block-compressed where the context supports it
+	DetectTextureCompression();
 
 	Shader simpleDepthShader("shadow_mapping_depth.vs", "shadow_mapping_depth.fs");
+	Shader cubeDepthShader("shadow_cube_depth.vs", "shadow_mapping_depth.fs", "shadow_cube_depth.gs");
+	Shader momentsDepthShader("shadow_cube_depth.vs", "shadow_moments.fs", "shadow_cube_depth.gs");
+	Shader momentsBlurShader("fullscreen.vs", "shadow_moments_blur.fs");
+	Shader prepassShader("depth_prepass.vs", "shadow_mapping_depth.fs");
+	Shader occlusionBoxShader("occlusion_box.vs", "shadow_mapping_depth.fs");
 	Shader objShader("object.vs", "object.fs"), lampShader("lamp.vs", "lamp.fs"), windowShader("window.vs", "window.fs");
-	Shader sofaShader("sofa.vs", "sofa.fs");
+	Shader sofaShader("sofa.vs", "sofa.fs"), batchShader("batch.vs", "batch.fs");
 	Shader debugDepthQuad("debug_quad.vs", "debug_quad.fs");
+	// deferred path: G-buffer shaders of each forward shader, and the lighting pass
+	Shader gbufferObjShader("object.vs", "gbuffer_object.fs"), gbufferWindowShader("window.vs", "gbuffer_window.fs");
+	Shader gbufferLampShader("lamp.vs", "gbuffer_lamp.fs"), gbufferSofaShader("sofa.vs", "gbuffer_sofa.fs");
+	Shader gbufferBatchShader("batch.vs", "gbuffer_batch.fs");
+	Shader deferredLightingShader("fullscreen.vs", "deferred_lighting.fs");
 
 	float vertices[] = {
 		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, 1.0f,
@@ -140,29 +321,28 @@ int main()
 		 //0.5f,  0.5f,  0.5f,  -1.0f,  0.0f,  0.0f,
 	};
 
-	GLuint objVAO, VBO;
-	glGenVertexArrays(1, &objVAO);
-	glBindVertexArray(objVAO);
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	GLStateCache &glState = GLStateCache::get();
+
+	GLVertexArray objVAO = GLVertexArray::create();
+	glState.bindVertexArray(objVAO.get());
+	GLBuffer VBO = GLBuffer::create();
+	glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), BUFFER_OFFSET(0));
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), BUFFER_OFFSET(3 * sizeof(float))); // 
 	glEnableVertexAttribArray(1);
 
-	GLuint lampVAO;
-	glGenVertexArrays(1, &lampVAO);
-	glBindVertexArray(lampVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO); // ͵ƹһ㻺(VBO)ǰѾ䵽VBO
+	GLVertexArray lampVAO = GLVertexArray::create();
+	glState.bindVertexArray(lampVAO.get());
+	glBindBuffer(GL_ARRAY_BUFFER, VBO.get()); // ͵ƹһ㻺(VBO)ǰѾ䵽VBO
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), BUFFER_OFFSET(0));
 	glEnableVertexAttribArray(0);
 
-	GLuint windowVAO, windowVBO;
-	glGenVertexArrays(1, &windowVAO);
-	glBindVertexArray(windowVAO);
-	glGenBuffers(1, &windowVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, windowVBO);
+	GLVertexArray windowVAO = GLVertexArray::create();
+	glState.bindVertexArray(windowVAO.get());
+	GLBuffer windowVBO = GLBuffer::create();
+	glBindBuffer(GL_ARRAY_BUFFER, windowVBO.get());
 	glBufferData(GL_ARRAY_BUFFER, sizeof(window_vertices), window_vertices, GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), BUFFER_OFFSET(0));
 	glEnableVertexAttribArray(0);
@@ -172,68 +352,239 @@ int main()
 	glEnableVertexAttribArray(2);
 
 	objShader.use();
-	objShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
+	// material constants and the lamp's light come from the scene file
+	glm::vec3 roomDiffuse(roomSurface.diffuse[0], roomSurface.diffuse[1], roomSurface.diffuse[2]);
+	glm::vec3 roomSpecular(roomSurface.specular[0], roomSurface.specular[1], roomSurface.specular[2]);
+	glm::vec3 windowSpecular(windowSurface.specular[0], windowSurface.specular[1], windowSurface.specular[2]);
+
+	objShader.setVec3("objectColor", roomDiffuse);
 	objShader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
-	objShader.setVec3("material.ambient", 1.0f, 0.5f, 0.31f);
-	objShader.setVec3("material.diffuse", 1.0f, 0.5f, 0.31f);
-	objShader.setVec3("material.specular", 0.5f, 0.5f, 0.5f);
-	objShader.setFloat("material.shininess", 32.0f);
-	objShader.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-	objShader.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f); // յһЩԴ䳡
-	objShader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
+	objShader.setVec3("material.ambient", roomDiffuse);
+	objShader.setVec3("material.diffuse", roomDiffuse);
+	objShader.setVec3("material.specular", roomSpecular);
+	objShader.setFloat("material.shininess", roomSurface.shininess);
+	objShader.setVec3("light.ambient", lightAmbient);
+	objShader.setVec3("light.diffuse", lightDiffuse); // յһЩԴ䳡
+	objShader.setVec3("light.specular", lightSpecular);
 	objShader.setVec3("light.position", lampPos);
 
 	objShader.setInt("shadowMap", 0);
 
-	unsigned int diffuseMap = loadTexture("window6.jpg");
+	GLTexture diffuseMap(loadTexture(windowSurface.texture.pointer));
 
 	windowShader.use();
 	windowShader.setInt("material.diffuse", 0);
-	windowShader.setVec3("material.specular", 0.5f, 0.5f, 0.5f);
-	windowShader.setFloat("material.shininess", 64.0f);
-	windowShader.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-	windowShader.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f); // յһЩԴ䳡
-	windowShader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
+	windowShader.setVec3("material.specular", windowSpecular);
+	windowShader.setFloat("material.shininess", windowSurface.shininess);
+	windowShader.setVec3("light.ambient", lightAmbient);
+	windowShader.setVec3("light.diffuse", lightDiffuse); // յһЩԴ䳡
+	windowShader.setVec3("light.specular", lightSpecular);
 	windowShader.setVec3("light.position", lampPos);
 
 	sofaShader.use();
-	sofaShader.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-	sofaShader.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f);
-	sofaShader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
+	sofaShader.setVec3("light.ambient", lightAmbient);
+	sofaShader.setVec3("light.diffuse", lightDiffuse);
+	sofaShader.setVec3("light.specular", lightSpecular);
 	sofaShader.setVec3("light.position", lampPos);
 
+	batchShader.use();
+	batchShader.setVec3("light.ambient", lightAmbient);
+	batchShader.setVec3("light.diffuse", lightDiffuse);
+	batchShader.setVec3("light.specular", lightSpecular);
+	batchShader.setVec3("light.position", lampPos);
+
+	gbufferObjShader.use();
+	gbufferObjShader.setVec3("material.diffuse", roomDiffuse);
+	gbufferObjShader.setVec3("material.specular", roomSpecular);
+	gbufferObjShader.setFloat("material.shininess", roomSurface.shininess);
+
+	gbufferWindowShader.use();
+	gbufferWindowShader.setInt("material.diffuse", 0);
+	gbufferWindowShader.setVec3("material.specular", windowSpecular);
+	gbufferWindowShader.setFloat("material.shininess", windowSurface.shininess);
+
+	deferredLightingShader.use();
+	deferredLightingShader.setVec3("light.ambient", lightAmbient);
+	deferredLightingShader.setVec3("light.diffuse", lightDiffuse);
+	deferredLightingShader.setVec3("light.specular", lightSpecular);
+	deferredLightingShader.setVec3("light.position", lampPos);
+
 	// Ӱɣ֡ʼ-------------------------------------
 	// Configure depth map FBO
 	const GLuint SHADOW_WIDTH = 4096, SHADOW_HEIGHT = 4096;
-	GLuint depthMapFBO;
-	glGenFramebuffers(1, &depthMapFBO);
+	GLFramebuffer depthMapFBO = GLFramebuffer::create();
 	// - Create depth texture
-	GLuint depthMap;
-	glGenTextures(1, &depthMap);
-	glBindTexture(GL_TEXTURE_2D, depthMap);
+	GLTexture depthMap = GLTexture::create();
+	glState.bindTexture(GL_TEXTURE_2D, depthMap.get());
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	// sampled as sampler2DShadow: the texture unit compares and filters the 2x2 texels around each fetch
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	GLfloat borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
 	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO.get());
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap.get(), 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Omnidirectional shadows: a depth cube map around the lamp, all six faces rendered in one layered pass
+	const GLuint SHADOW_CUBE_SIZE = 1024;
+	GLFramebuffer depthCubeMapFBO = GLFramebuffer::create();
+	GLTexture depthCubeMap = GLTexture::create();
+	glState.bindTexture(GL_TEXTURE_CUBE_MAP, depthCubeMap.get());
+	for (GLuint face = 0; face < 6; face++)
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT, SHADOW_CUBE_SIZE, SHADOW_CUBE_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, depthCubeMapFBO.get());
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubeMap.get(), 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// - or its moments, at half the resolution: the blur and mipmaps make up for it
+	MomentShadowMap momentShadows;
+	if (evsmShadows && momentShadows.create(SHADOW_CUBE_SIZE / 2))
+		momentShadows.printStats(std::cout);
+	else
+		evsmShadows = false;
+	if (!evsmShadows)
+		std::cout << "Shadow kernel: " << SHADOW_KERNEL_NAMES[shadowKernel] << ", " << SHADOW_KERNEL_FETCHES[shadowKernel]
+			<< " filtered fetches per lookup" << std::endl;
 	// Ӱɣ֡ʼ-------------------------------------
 
+	DeferredRenderer deferred;
+	if (deferredShading && deferred.create(SCR_WIDTH, SCR_HEIGHT))
+	{
+		deferred.addInput("shadowMap", depthMap.get());
+		deferred.addInput("shadowCubeMap", depthCubeMap.get(), GL_TEXTURE_CUBE_MAP);
+		deferred.addInput("shadowMomentsCube", momentShadows.getTexture(), GL_TEXTURE_CUBE_MAP);
+		deferred.printStats(std::cout);
+	}
+	else
+		deferredShading = false;
+
+	// GL uploads of streamed assets; declared before the job system so loads still in flight at exit can post to it
+	StreamingQueue streaming;
+	// stages their texture and buffer data through a fenced ring, UPLOAD_BUDGET bytes a frame
+	UploadManager uploads(16 << 20, UPLOAD_BUDGET);
+	// shared job system: model import and frame preparation run on its workers
+	JobSystem jobs;
+	// keeps the mip levels each texture needs on screen resident, within TEXTURE_BUDGET
+	TextureResidency &residency = TextureResidency::get();
+	residency.configure(jobs, streaming, &uploads, TEXTURE_BUDGET);
+
 	// load models
 	// -----------
-	Model ourModel("nanosuit/nanosuit.obj");
-
+	// returns at once; meshes appear as they become resident, with placeholder textures until theirs arrive
+	// the batch is built from the vertices, which are released once it is
+	std::shared_ptr<Model> ourModel = Model::LoadAsync(scene.getObject(modelObject).asset.pointer, jobs, streaming, &uploads, true, false,
+		batchModel ? Geometry_Retention::ALL : keepGeometry);
+
+
+	// textures of the hand-built objects, bound by the render queue
+	Material roomMaterial;
+	roomMaterial.addTexture("shadowMap", depthMap.get());
+	roomMaterial.addTexture("shadowCubeMap", depthCubeMap.get(), GL_TEXTURE_CUBE_MAP);
+	roomMaterial.addTexture("shadowMomentsCube", momentShadows.getTexture(), GL_TEXTURE_CUBE_MAP);
+	Material windowMaterial;
+	windowMaterial.addTexture("material.diffuse", diffuseMap.get());
+
+	// object-space bounds of the hand-built objects, used for culling and depth sorting
+	AABB cubeBounds(-0.5f, 0.5f, -0.5f, 0.5f, -0.5f, 0.5f);
+	AABB windowBounds(-0.5f, -0.5f, -0.5f, 0.5f, -0.5f, 0.5f);
+
+	// the scene's transforms; the scene graph owns them and hands every pass the same world matrices
+	SceneGraph sceneGraph;
+	int sceneRoot = sceneGraph.addNode(SceneGraph::NO_PARENT, glm::mat4());
+	std::vector<int> objectNodes;
+	for (unsigned int i = 0; i < scene.getObjectCount(); i++)
+	{
+		const SceneObject &object = scene.getObject(i);
+		objectNodes.push_back(sceneGraph.addNode(object.parent >= 0 ? objectNodes[object.parent] : sceneRoot, SceneFile::getTransform(object)));
+	}
+	// the model's own hierarchy goes below its object's node once its file is read
+	int suitNode = objectNodes[modelObject];
+	int suitMeshNodes = -1;
+	sceneGraph.update();
+
+	// everything the passes may draw: the scene's built-in shapes
+	EntityStore entities;
+	for (unsigned int i = 0; i < scene.getObjectCount(); i++)
+	{
+		std::string shape = scene.getObject(i).shape.pointer;
+		const glm::mat4 &world = sceneGraph.getWorld(objectNodes[i]);
+		Renderable object;
+		if (shape == "room")
+		{
+			object = makeRenderable(arrayDrawItem(objShader, &roomMaterial, objVAO.get(), 30, world), cubeBounds);
+			object.gbufferShader = &gbufferObjShader;
+			object.collision = Collision_Shape::ENCLOSURE;
+		}
+		else if (shape == "window")
+		{
+			object = makeRenderable(arrayDrawItem(windowShader, &windowMaterial, windowVAO.get(), 6, world), windowBounds);
+			object.gbufferShader = &gbufferWindowShader;
+			object.collision = Collision_Shape::NONE;
+		}
+		else if (shape == "lamp")
+		{
+			object = makeRenderable(arrayDrawItem(lampShader, NULL, lampVAO.get(), 36, world), cubeBounds, false);
+			object.gbufferShader = &gbufferLampShader;
+		}
+		else
+		{
+			if (shape != "model")
+				std::cout << "ERROR::SCENE:: unknown shape " << shape << " of " << scene.getObject(i).name.pointer << std::endl;
+			continue;
+		}
+		object.node = objectNodes[i];
+		entities.add(object);
+	}
+	// the model's entities follow and are rebuilt whenever more of it becomes resident
+	const size_t staticEntities = entities.size();
+	std::vector<Renderable> modelRenderables;
+	unsigned int modelVersion = 0;
+	ModelBatch batch;
+
+	// point lights assigned to view-space clusters every frame, read by the scene's fragment shaders
+	ClusteredLights clusteredLights;
+
+	// the room's walls hide whatever is behind them from the scene pass
+	OcclusionCuller occlusion;
+	for (unsigned int i = 0; i < scene.getObjectCount(); i++)
+		if (std::strcmp(scene.getObject(i).shape.pointer, "room") == 0)
+			occlusion.addOccluder(vertices, 30, 6, sceneGraph.getWorld(objectNodes[i]));
+	// - or the model's meshes are tested by the GPU against the depth of the previous frames
+	OcclusionQueries occlusionQueries;
+	if (gpuOcclusion)
+		occlusionQueries.create();
+
+	// frame preparation runs on the workers, the GL thread only replays the recorded queues
+	PassRecorder shadowRecorder, prepassRecorder, sceneRecorder;
+	RenderQueue shadowQueue, prepassQueue, sceneQueue;
+	// GPU time of each pass; in the deferred path sceneTimer measures the G-buffer pass
+	GpuTimer shadowTimer, prepassTimer, sceneTimer, lightingTimer;
+	// samples of the scene pass that pass the depth test: with early-Z, the fragments it shades
+	GpuTimer sceneFragments(GL_SAMPLES_PASSED);
 
 	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
+	float lastStatsTime = 0.0f;
+
 	// render loop
 	// -----------
 	while (!glfwWindowShouldClose(window))
@@ -244,11 +595,94 @@ int main()
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
+		// statistics of the previous frame, reported once per second with --stats
+		glState.beginFrame();
+		if (showStats && currentFrame - lastStatsTime >= 1.0f)
+		{
+			glState.printFrameStats(std::cout);
+			std::cout << "Recorded draws: shadow " << shadowQueue.size() << " (" << shadowRecorder.getCulledCount() << " culled), scene " << sceneQueue.size()
+				<< " (" << sceneRecorder.getCulledCount() << " culled); draw calls: shadow " << shadowQueue.getDrawCalls()
+				<< ", scene " << sceneQueue.getDrawCalls() << std::endl;
+			sceneGraph.printStats(std::cout);
+			entities.printStats(std::cout);
+			if (occlusionCulling)
+				occlusion.printStats(std::cout);
+			if (gpuOcclusion)
+				occlusionQueries.printStats(std::cout);
+			if (omniShadows)
+				std::cout << "Shadow cube: " << shadowQueue.size() << " casters drawn into " << shadowRecorder.getLayerDrawCount()
+					<< " faces (of " << shadowQueue.size() * 6 << " without per-face culling)" << std::endl;
+			std::cout << "GPU: shadow " << shadowTimer.getMilliseconds() << " ms, ";
+			if (deferredShading)
+				std::cout << "G-buffer " << sceneTimer.getMilliseconds() << " ms, lighting " << lightingTimer.getMilliseconds() << " ms" << std::endl;
+			else
+			{
+				if (depthPrepass)
+					std::cout << "depth pre-pass " << prepassTimer.getMilliseconds() << " ms, ";
+				// shaded fragments per pixel: 1 means no overdraw was shaded
+				std::cout << "scene " << sceneTimer.getMilliseconds() << " ms, " << (unsigned long)sceneFragments.getAverage() << " fragments shaded ("
+					<< sceneFragments.getAverage() / (SCR_WIDTH * SCR_HEIGHT) << " per pixel)" << std::endl;
+			}
+			shadowTimer.reset();
+			prepassTimer.reset();
+			sceneTimer.reset();
+			sceneFragments.reset();
+			lightingTimer.reset();
+			if (ourModel->getState() == Load_State::LOADING)
+				std::cout << "Streaming: " << ourModel->meshes.size() << " meshes resident, " << streaming.pending() << " uploads queued, "
+					<< streaming.getLastTime() * 1000.0 << " ms last frame; " << uploads.pendingBytes() / 1024 << " KB to stage, "
+					<< uploads.getLastFrameBytes() / 1024 << " KB staged last frame" << std::endl;
+			residency.printStats(std::cout);
+			ourModel->printStats(std::cout);
+			lastStatsTime = currentFrame;
+		}
+
+		// upload what the loaders have finished, within the frame's budget, and pick up newly resident meshes
+		streaming.update(STREAMING_BUDGET);
+		uploads.update();
+		bool modelChanged = ourModel->getResidentVersion() != modelVersion;
+		if (batchModel && !batch.isBuilt() && ourModel->getState() == Load_State::LOADED)
+		{
+			if (batch.build(*ourModel, jobs))
+			{
+				batch.setupShader(batchShader);
+				batch.setupShader(gbufferBatchShader);
+				batch.printStats(std::cout);
+			}
+			ourModel->releaseGeometry(keepGeometry);
+			batchModel = false;
+			modelChanged = true;
+		}
+		if (modelChanged && suitMeshNodes < 0 && !ourModel->nodes.empty())
+		{
+			suitMeshNodes = ourModel->AddToSceneGraph(sceneGraph, suitNode);
+			sceneGraph.update();
+		}
+		if (modelChanged && suitMeshNodes >= 0)
+		{
+			modelRenderables.clear();
+			if (batch.isBuilt())
+				batch.AppendRenderables(modelRenderables, batchShader, sceneGraph, suitMeshNodes, &gbufferBatchShader);
+			else
+				ourModel->AppendRenderables(modelRenderables, sofaShader, sceneGraph, suitMeshNodes, &gbufferSofaShader);
+			entities.resize(staticEntities);
+			entities.add(modelRenderables);
+			modelVersion = ourModel->getResidentVersion();
+			if (gpuOcclusion)
+				occlusionQueries.reset(entities.size(), staticEntities);
+		}
+		// world matrices and boxes of whatever moved since the last frame
+		if (sceneGraph.update())
+			entities.updateTransforms(jobs, sceneGraph);
+		// occlusion query results the GPU has finished since, applied to this frame
+		if (gpuOcclusion)
+			occlusionQueries.collect();
+
 		// input
 		// -----
 		processInput(window);
 
-		// 1. Render depth of scene to texture (from light's perspective)
+		// 1. Record the frame on the workers
 		// - Get light projection/view matrix.
 		glm::mat4 lightProjection, lightView;
 		glm::mat4 lightSpaceMatrix;
@@ -257,108 +691,200 @@ int main()
 		lightProjection = glm::perspective(glm::radians(90.0f), (GLfloat)SHADOW_WIDTH / (GLfloat)SHADOW_HEIGHT, near_plane, far_plane); // Note that if you use a perspective projection matrix you'll have to change the light position as the current light position isn't enough to reflect the whole scene.
 		lightView = glm::lookAt(lampPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
 		lightSpaceMatrix = lightProjection * lightView;
-		// - now render scene from light's point of view
-		simpleDepthShader.use();
-		simpleDepthShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-
-		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		{
-			glm::mat4 model;
-			model = glm::scale(model, glm::vec3(10.0f));
-			simpleDepthShader.setMat4("model", model);
-			glBindVertexArray(objVAO);
-			glDrawArrays(GL_TRIANGLES, 0, 30);
-
-			model = glm::mat4();
-			model = glm::scale(model, glm::vec3(10.0f, 4.0f, 4.0f));
-			model = glm::translate(model, glm::vec3(0.005f, 0.0f, 0.0f));
-			simpleDepthShader.setMat4("model", model);
-			glBindVertexArray(windowVAO);
-			glDrawArrays(GL_TRIANGLES, 0, 6);
-
-			model = glm::mat4();
-			model = glm::translate(model, glm::vec3(3.0f, -5.0f, -2.0f)); // translate it down so it's at the center of the scene
-			model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));	// it's a bit too big for our scene, so scale it down
-			simpleDepthShader.setMat4("model", model);
-			ourModel.Draw(simpleDepthShader);
-		}
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-		// render
-		// ------
-		glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // also clear the depth buffer now!
-
+		// - or the six 90 degree views around the lamp, +X, -X, +Y, -Y, +Z, -Z
+		GLfloat cubeNear = 0.1f;
+		glm::mat4 cubeProjection = glm::perspective(glm::radians(90.0f), 1.0f, cubeNear, far_plane);
+		static const glm::vec3 cubeDirections[6] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+			glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+		static const glm::vec3 cubeUps[6] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+			glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+		glm::mat4 cubeMatrices[6];
+		for (int face = 0; face < 6; face++)
+			cubeMatrices[face] = cubeProjection * glm::lookAt(lampPos, lampPos + cubeDirections[face], cubeUps[face]);
+
+		// - Get camera projection/view matrix.
 		glm::vec3 cameraPosition = camera.getCameraPosition();
-		objShader.use();
-		objShader.setVec3("viewPos", cameraPosition);
 		glm::mat4 projection;
 		// ͶӰ豣ͼݺ
 		if (camera.getProjectionType() == Projection_Type::PERSPECTIVE)
 			projection = glm::perspective(glm::radians(camera.getFov()), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 		else
 			projection = glm::ortho(-2.0f * (float)SCR_WIDTH / (float)SCR_HEIGHT, 2.0f * (float)SCR_WIDTH / (float)SCR_HEIGHT, -2.0f, 2.0f, 0.1f, 100.0f);
-
-		objShader.setMat4("projection", projection);
 		glm::mat4 view = camera.getViewMatrix();
-		objShader.setMat4("view", view);
-		glm::mat4 model;
-		model = glm::scale(model, glm::vec3(10.0f));
-		objShader.setMat4("model", model);
-		objShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-		objShader.setBool("shadows", true);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depthMap);
-		glBindVertexArray(objVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 30);
-
-		windowShader.use();
-		windowShader.setVec3("viewPos", camera.getCameraPosition());
-
-		windowShader.setMat4("projection", projection);
-		windowShader.setMat4("view", view);
-
-		model = glm::mat4();
-		model = glm::scale(model, glm::vec3(10.0f, 4.0f, 4.0f));
-		model = glm::translate(model, glm::vec3(0.005f, 0.0f, 0.0f));
-		windowShader.setMat4("model", model);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, diffuseMap);
-
-		glBindVertexArray(windowVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-
-		lampShader.use();
-		lampShader.setMat4("projection", projection);
-		lampShader.setMat4("view", view);
-		model = glm::mat4();
-		model = glm::translate(model, lampPos);
-		model = glm::scale(model, glm::vec3(0.2f));
-		lampShader.setMat4("model", model);
-
-		glBindVertexArray(lampVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		sofaShader.use();
-		sofaShader.setVec3("viewPos", cameraPosition);
-		sofaShader.setMat4("projection", projection);
-		sofaShader.setMat4("view", view);
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(3.0f, -5.0f, -2.0f)); // translate it down so it's at the center of the scene
-		model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));	// it's a bit too big for our scene, so scale it down
-		sofaShader.setMat4("model", model);
-		ourModel.Draw(sofaShader);
+
+		// - depth pass from the light's point of view and main pass from the camera are recorded in parallel:
+		//   culling, sort keys, sorting and uniform values. No GL calls happen on the workers.
+		PassDesc shadowPass;
+		shadowPass.view = lightView;
+		shadowPass.projection = omniShadows ? cubeProjection : lightProjection;
+		shadowPass.farPlane = far_plane;
+		shadowPass.depthShader = evsmShadows ? &momentsDepthShader : omniShadows ? &cubeDepthShader : &simpleDepthShader;
+		shadowPass.castersOnly = true;
+		shadowPass.gbuffer = false;
+		// casters outside the light's frustum (per cube face) cannot reach the depth map, and those whose
+		// shadow misses the camera's frustum cannot darken anything on screen
+		Frustum cameraFrustum(projection * view);
+		shadowPass.cull = true;
+		shadowPass.receiverFrustum = &cameraFrustum;
+		shadowPass.lightPosition = lampPos;
+		shadowPass.occlusion = NULL; // hidden casters may still shadow what the camera sees
+		shadowPass.hidden = NULL;
+		shadowPass.layerViewProjections = omniShadows ? cubeMatrices : NULL;
+		shadowPass.layerCount = omniShadows ? 6 : 0;
+		shadowPass.textureFeedback = false;
+		shadowPass.viewportHeight = (float)SHADOW_HEIGHT;
+
+		PassDesc scenePass;
+		scenePass.view = view;
+		scenePass.projection = projection;
+		scenePass.farPlane = 100.0f;
+		scenePass.depthShader = NULL;
+		scenePass.castersOnly = false;
+		scenePass.gbuffer = deferredShading;
+		scenePass.cull = true;
+		scenePass.receiverFrustum = NULL;
+		scenePass.occlusion = occlusionCulling ? &occlusion : NULL;
+		scenePass.hidden = gpuOcclusion ? &occlusionQueries.getHidden() : NULL;
+		scenePass.layerViewProjections = NULL;
+		scenePass.layerCount = 0;
+		scenePass.textureFeedback = true;
+		scenePass.viewportHeight = (float)SCR_HEIGHT;
+
+		// - the depth pre-pass sees what the scene pass sees, through the position-only path of the shadow passes
+		PassDesc prepass = scenePass;
+		prepass.depthShader = &prepassShader;
+		prepass.castersOnly = false;
+		prepass.gbuffer = false;
+		prepass.textureFeedback = false;
+
+		// - the point lights move every frame and are assigned to the camera's clusters alongside
+		AnimateTestLights(clusteredLights.lights, SCENE_LIGHTS, currentFrame);
+
+		// the occluders are rasterized first; the passes seen from the camera wait for them
+		JobCounter recording, occluders;
+		if (occlusionCulling)
+			jobs.run([&]() {
+				occlusion.render(jobs, projection * view);
+			}, &occluders);
+		jobs.run([&]() {
+			shadowRecorder.record(jobs, shadowQueue, shadowPass, entities);
+			shadowQueue.passUniforms.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+			for (int face = 0; face < 6; face++)
+				shadowQueue.passUniforms.setMat4("shadowMatrices[" + std::to_string(face) + "]", cubeMatrices[face]);
+			shadowQueue.passUniforms.setFloat("shadowCubeFar", far_plane);
+			shadowQueue.passUniforms.setFloat("evsmExponent", EVSM_EXPONENT);
+		}, &recording);
+		if (depthPrepass)
+			jobs.run([&]() {
+				prepassRecorder.record(jobs, prepassQueue, prepass, entities);
+				prepassQueue.passUniforms.setMat4("projection", projection);
+				prepassQueue.passUniforms.setMat4("view", view);
+			}, &recording, &occluders);
+		jobs.run([&]() {
+			clusteredLights.assign(jobs, view, projection, 0.1f, 100.0f, (float)SCR_WIDTH, (float)SCR_HEIGHT);
+		}, &recording);
+		jobs.run([&]() {
+			sceneRecorder.record(jobs, sceneQueue, scenePass, entities);
+			UniformBlock &uniforms = sceneQueue.passUniforms;
+			uniforms.setVec3("viewPos", cameraPosition);
+			uniforms.setMat4("projection", projection);
+			uniforms.setMat4("view", view);
+			uniforms.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+			uniforms.setBool("shadows", true);
+			uniforms.setBool("omniShadows", omniShadows);
+			uniforms.setFloat("shadowCubeNear", cubeNear);
+			uniforms.setFloat("shadowCubeFar", far_plane);
+			uniforms.setBool("evsmShadows", evsmShadows);
+			uniforms.setFloat("evsmExponent", EVSM_EXPONENT);
+			uniforms.setInt("shadowKernel", shadowKernel);
+			uniforms.setMat4("inverseViewProjection", glm::inverse(projection * view)); // deferred lighting
+		}, &recording, &occluders);
+		jobs.wait(recording);
+		jobs.wait(occluders);
+		// the scene pass reported the screen size of every visible material: evict or stream mip levels
+		residency.update();
+		clusteredLights.setUniforms(sceneQueue.passUniforms);
+
+		// 2. Render depth of scene to texture (from light's perspective)
+		shadowTimer.begin();
+		if (evsmShadows)
+			momentShadows.beginDepth(EVSM_EXPONENT);
+		else if (omniShadows)
+		{
+			glViewport(0, 0, SHADOW_CUBE_SIZE, SHADOW_CUBE_SIZE);
+			glBindFramebuffer(GL_FRAMEBUFFER, depthCubeMapFBO.get());
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+		else
+		{
+			glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+			glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO.get());
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+		shadowQueue.submit();
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		// the moments are blurred and mipmapped once, instead of filtered by every fragment that reads them
+		if (evsmShadows)
+			momentShadows.filter(momentsBlurShader);
+		shadowTimer.end();
+
+		// render
+		// ------
+		clusteredLights.upload();
+		clusteredLights.bind();
+		if (deferredShading)
+		{
+			// surfaces into the G-buffer, then every pixel lit once
+			sceneTimer.begin();
+			deferred.beginGeometry();
+			sceneQueue.submit();
+			if (gpuOcclusion)
+				occlusionQueries.issue(occlusionBoxShader, entities, projection * view, cameraPosition);
+			deferred.endGeometry();
+			sceneTimer.end();
+
+			glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			lightingTimer.begin();
+			deferred.light(deferredLightingShader, sceneQueue.passUniforms);
+			lightingTimer.end();
+		}
+		else
+		{
+			glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // also clear the depth buffer now!
+			if (depthPrepass)
+			{
+				// depth only, then shade just the fragments that ended up visible, without writing depth again
+				prepassTimer.begin();
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				prepassQueue.submit();
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				prepassTimer.end();
+				glDepthFunc(GL_EQUAL);
+				glDepthMask(GL_FALSE);
+			}
+			sceneTimer.begin();
+			sceneFragments.begin();
+			sceneQueue.submit();
+			sceneFragments.end();
+			if (depthPrepass)
+			{
+				glDepthFunc(GL_LESS);
+				glDepthMask(GL_TRUE);
+			}
+			// the boxes against the finished depth buffer; the results are read in a later frame
+			if (gpuOcclusion)
+				occlusionQueries.issue(occlusionBoxShader, entities, projection * view, cameraPosition);
+			sceneTimer.end();
+		}
 
 		// 3. DEBUG: visualize depth map by rendering it to plane
 		debugDepthQuad.use();
 		debugDepthQuad.setFloat("near_plane", near_plane);
 		debugDepthQuad.setFloat("far_plane", far_plane);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depthMap);
+		glState.bindTextureUnit(0, GL_TEXTURE_2D, depthMap.get());
+		// the depth map compares in hardware: set its GL_TEXTURE_COMPARE_MODE to GL_NONE before showing it
 		//RenderQuad();
 
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -456,42 +982,30 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 
 unsigned int loadTexture(char const * path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+	// same pipeline as the model textures, so these are block-compressed and cached too
+	TextureImage image;
+	DecodeTextureFile(path, ".", image);
+	return TextureFromImage(image, path);
+}
 
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
 
-	return textureID;
+// describes a non-indexed draw of the first count vertices of vao
+DrawItem arrayDrawItem(const Shader &shader, const Material *material, GLuint vao, GLsizei count, const glm::mat4 &model)
+{
+	DrawItem item;
+	item.shader = &shader;
+	item.material = material;
+	item.vao = vao;
+	item.mode = GL_TRIANGLES;
+	item.first = 0;
+	item.count = count;
+	item.baseVertex = 0;
+	item.indexed = false;
+	item.model = model;
+	item.layerMask = 0;
+	return item;
 }
 
-
 // RenderQuad() Renders a 1x1 quad in NDC, best used for framebuffer color targets
 // and post-processing effects.
 GLuint quadVAO = 0;
@@ -510,7 +1024,7 @@ void RenderQuad()
 		// Setup plane VAO
 		glGenVertexArrays(1, &quadVAO);
 		glGenBuffers(1, &quadVBO);
-		glBindVertexArray(quadVAO);
+		GLStateCache::get().bindVertexArray(quadVAO);
 		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
@@ -518,7 +1032,6 @@ void RenderQuad()
 		glEnableVertexAttribArray(1);
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
 	}
-	glBindVertexArray(quadVAO);
+	GLStateCache::get().bindVertexArray(quadVAO);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
 }
\ No newline at end of file
@@ -0,0 +1,11 @@
+#version 330 core
+// --gpu-occlusion: the bounding box of an object, drawn inside an occlusion query (OcclusionQueries.h)
+layout (location = 0) in vec3 position;
+
+uniform mat4 viewProjection;
+uniform mat4 model; // the unit cube to the box
+
+void main()
+{
+    gl_Position = viewProjection * model * vec4(position, 1.0);
+}
@@ -0,0 +1,39 @@
+#version 330 core
+// Renders the depth of the six faces of the cube shadow map in one pass: each triangle is sent to
+// the faces it can be seen in (gl_Layer). layerMask holds the faces the object's bounds reach;
+// triangles outside a face's frustum are dropped as well, so most go to one or two faces.
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+uniform mat4 shadowMatrices[6]; // +X, -X, +Y, -Y, +Z, -Z
+uniform int layerMask;
+
+out float LightDepth; // distance along the face's axis, for shadow_moments.fs
+
+void main()
+{
+    for (int face = 0; face < 6; face++)
+    {
+        if ((layerMask & (1 << face)) == 0)
+            continue;
+        vec4 clip[3];
+        for (int i = 0; i < 3; i++)
+            clip[i] = shadowMatrices[face] * gl_in[i].gl_Position;
+        // outside the face when all three vertices are beyond the same clip plane
+        vec3 x = vec3(clip[0].x, clip[1].x, clip[2].x);
+        vec3 y = vec3(clip[0].y, clip[1].y, clip[2].y);
+        vec3 z = vec3(clip[0].z, clip[1].z, clip[2].z);
+        vec3 w = vec3(clip[0].w, clip[1].w, clip[2].w);
+        if (all(lessThan(x, -w)) || all(greaterThan(x, w)) || all(lessThan(y, -w)) || all(greaterThan(y, w))
+            || all(lessThan(z, -w)) || all(greaterThan(z, w)))
+            continue;
+        for (int i = 0; i < 3; i++)
+        {
+            gl_Layer = face;
+            gl_Position = clip[i];
+            LightDepth = clip[i].w;
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
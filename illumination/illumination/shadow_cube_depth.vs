@@ -0,0 +1,10 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+
+uniform mat4 model;
+
+// world space; shadow_cube_depth.gs projects it into the faces
+void main()
+{
+    gl_Position = model * vec4(position, 1.0);
+}
@@ -0,0 +1,129 @@
+// Shadow of the lamp, from a cube depth map around it, its moments (--evsm) or a single spot depth
+// map (--spot-shadows).
+// Included by the shaders that receive shadows: object.fs and deferred_lighting.fs.
+// Both depth maps compare in hardware (GL_TEXTURE_COMPARE_MODE) with linear filtering, so every
+// fetch already returns the lit fraction of the 2x2 texels around it.
+uniform sampler2DShadow shadowMap;       // spot: depth seen through lightSpaceMatrix
+uniform samplerCubeShadow shadowCubeMap; // omnidirectional: depth of the six 90 degree views around the lamp
+uniform bool omniShadows;
+uniform float shadowCubeNear;      // near and far plane of the cube faces
+uniform float shadowCubeFar;
+uniform samplerCube shadowMomentsCube; // --evsm: blurred, mipmapped moments of the cube (MomentShadowMap.h)
+uniform bool evsmShadows;
+uniform float evsmExponent;
+
+// PCF kernels on top of the filtered fetches (--shadow-kernel in main.cpp)
+const int SHADOW_KERNEL_GRID = 0;    // 3x3 fetches one texel apart: the original loop
+const int SHADOW_KERNEL_POISSON = 1; // 8 fetches on a Poisson disk 1.5 texels wide
+const int SHADOW_KERNEL_ROTATED = 2; // 4 fetches on a rotated grid, covering 4x4 texels
+uniform int shadowKernel;
+
+const vec2 POISSON_DISK[8] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725), vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464), vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379));
+const vec2 ROTATED_GRID[4] = vec2[](vec2(-0.5, -1.5), vec2(1.5, -0.5), vec2(0.5, 1.5), vec2(-1.5, 0.5));
+
+int ShadowKernelSize()
+{
+    return shadowKernel == SHADOW_KERNEL_POISSON ? 8 : shadowKernel == SHADOW_KERNEL_ROTATED ? 4 : 9;
+}
+
+// offset of fetch i of the kernel, in texels
+vec2 ShadowKernelOffset(int i)
+{
+    if (shadowKernel == SHADOW_KERNEL_POISSON)
+        return POISSON_DISK[i] * 1.5;
+    if (shadowKernel == SHADOW_KERNEL_ROTATED)
+        return ROTATED_GRID[i];
+    return vec2(i % 3 - 1, i / 3 - 1);
+}
+
+// the spot shadow, only correct inside the cone the depth map covers
+float SpotShadow(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
+{
+    // perform perspective divide
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    // Transform to [0,1] range
+    projCoords = projCoords * 0.5 + 0.5;
+    // Get depth of current fragment from light's perspective
+    float currentDepth = projCoords.z;
+    // Calculate bias (based on depth map resolution and slope)
+    float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+    // PCF
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    int taps = ShadowKernelSize();
+    for(int i = 0; i < taps; ++i)
+        shadow += 1.0 - texture(shadowMap, vec3(projCoords.xy + ShadowKernelOffset(i) * texelSize, currentDepth - bias));
+    shadow /= float(taps);
+
+    // Keep the shadow at 0.0 when outside the far_plane region of the light's frustum.
+    if(projCoords.z > 1.0)
+        shadow = 0.0;
+
+    return shadow;
+}
+
+// window depth a point at v from the lamp gets in the cube face looking along v's dominant axis
+float CubeDepth(vec3 v)
+{
+    float z = max(abs(v.x), max(abs(v.y), abs(v.z)));
+    float n = shadowCubeNear, f = shadowCubeFar;
+    return ((f + n) / (f - n) - 2.0 * f * n / ((f - n) * z)) * 0.5 + 0.5;
+}
+
+// the cube shadow, all around the lamp; the depth is compared in hardware depth space so the cube
+// pass needs no fragment shader writing distances, and the texture unit does the comparison
+float OmniShadow(vec3 fragPos, vec3 lightPos, vec3 normal, vec3 lightDir)
+{
+    vec3 fromLight = fragPos - lightPos;
+    float distance = length(fromLight);
+    // bias in world units, from the size of a texel at this distance and the slope
+    float texel = 2.0 * distance / float(textureSize(shadowCubeMap, 0).x);
+    float bias = max(3.0 * texel * (1.0 - dot(normal, lightDir)), 1.5 * texel);
+    float currentDepth = CubeDepth(fromLight * ((distance - bias) / distance));
+    // PCF in the plane across the direction to the lamp, so the kernel keeps its shape on every face
+    vec3 direction = fromLight / distance;
+    vec3 tangent = normalize(cross(abs(direction.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), direction));
+    vec3 bitangent = cross(direction, tangent);
+    float shadow = 0.0;
+    int taps = ShadowKernelSize();
+    for(int i = 0; i < taps; ++i)
+    {
+        vec2 offset = ShadowKernelOffset(i) * texel;
+        shadow += 1.0 - texture(shadowCubeMap, vec4(fromLight + tangent * offset.x + bitangent * offset.y, currentDepth));
+    }
+    shadow /= float(taps);
+
+    // Keep the shadow at 0.0 beyond the far plane of the cube.
+    if(currentDepth > 1.0)
+        shadow = 0.0;
+
+    return shadow;
+}
+
+// the cube shadow from its moments: one filtered fetch and Chebyshev's upper bound on the lit fraction
+float MomentShadow(vec3 fragPos, vec3 lightPos)
+{
+    vec3 fromLight = fragPos - lightPos;
+    float depth = max(abs(fromLight.x), max(abs(fromLight.y), abs(fromLight.z))) / shadowCubeFar;
+    if (depth > 1.0)
+        return 0.0;
+    float warped = exp(evsmExponent * (depth - 0.002));
+    vec2 moments = texture(shadowMomentsCube, fromLight).xy;
+    // a floor on the variance keeps float precision from darkening lit surfaces
+    float variance = max(moments.y - moments.x * moments.x, 1e-4 * warped * warped);
+    float d = warped - moments.x;
+    float lit = d <= 0.0 ? 1.0 : variance / (variance + d * d);
+    // cut the low end of the bound, where overlapping occluders let light bleed through
+    lit = clamp((lit - 0.3) / 0.7, 0.0, 1.0);
+    return 1.0 - lit;
+}
+
+// 0 when lit, 1 when fully in shadow; normal and lightDir are normalized, in world space
+float ShadowCalculation(vec4 fragPosLightSpace, vec3 fragPos, vec3 lightPos, vec3 normal, vec3 lightDir)
+{
+    if (!omniShadows)
+        return SpotShadow(fragPosLightSpace, normal, lightDir);
+    return evsmShadows ? MomentShadow(fragPos, lightPos) : OmniShadow(fragPos, lightPos, normal, lightDir);
+}
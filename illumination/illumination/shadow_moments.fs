@@ -0,0 +1,16 @@
+#version 330 core
+// --evsm: the cube pass writes exponentially warped depth and its square instead of depth alone, so
+// the shadow map can be blurred and mipmapped like any texture (MomentShadowMap.h)
+in float LightDepth;
+out vec2 Moments;
+
+uniform float shadowCubeFar;
+uniform float evsmExponent;
+
+void main()
+{
+    float warped = exp(evsmExponent * LightDepth / shadowCubeFar);
+    // the slope of the surface inside the texel widens the distribution a little, against acne
+    float dx = dFdx(warped), dy = dFdy(warped);
+    Moments = vec2(warped, warped * warped + 0.25 * (dx * dx + dy * dy));
+}
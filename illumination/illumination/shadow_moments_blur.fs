@@ -0,0 +1,26 @@
+#version 330 core
+// One direction of the separable blur of the moment shadow map: a 9-tap Gaussian taken with five
+// bilinear fetches, each between two texels. Drawn with fullscreen.vs over a target of the
+// source's size.
+out vec2 Moments;
+
+uniform sampler2DArray source;
+uniform int layer;
+uniform bool horizontal;
+
+const float offsets[3] = float[](0.0, 1.3846153846, 3.2307692308);
+const float weights[3] = float[](0.2270270270, 0.3162162162, 0.0702702703);
+
+void main()
+{
+    vec2 texel = 1.0 / vec2(textureSize(source, 0).xy);
+    vec2 uv = gl_FragCoord.xy * texel;
+    vec2 direction = horizontal ? vec2(1.0, 0.0) : vec2(0.0, 1.0);
+    vec2 sum = texture(source, vec3(uv, layer)).xy * weights[0];
+    for (int i = 1; i < 3; i++)
+    {
+        vec2 offset = direction * offsets[i] * texel;
+        sum += (texture(source, vec3(uv + offset, layer)).xy + texture(source, vec3(uv - offset, layer)).xy) * weights[i];
+    }
+    Moments = sum;
+}
@@ -20,6 +20,8 @@ struct Light {
 
 uniform Light light;
 
+#include "clustered_lights.glsl"
+
 void main()
 {    
 	// ambient
@@ -38,6 +40,7 @@ void main()
     vec3 specular = light.specular * spec * texture(texture_specular1, TexCoords).rgb;  
         
     vec3 result = ambient + diffuse + specular;
+    result += ClusteredLighting(FragPos, norm, viewDir, texture(texture_diffuse1, TexCoords).rgb, texture(texture_specular1, TexCoords).rgb, 32.0);
     FragColor = vec4(result, 1.0);
 
 	//FragColor = texture(texture_specular1, TexCoords);
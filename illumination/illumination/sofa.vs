@@ -3,6 +3,8 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+invariant gl_Position;
+
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
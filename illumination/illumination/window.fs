@@ -23,6 +23,8 @@ uniform vec3 viewPos;
 uniform Material material;
 uniform Light light;
 
+#include "clustered_lights.glsl"
+
 void main()
 {
     // ambient
@@ -41,5 +43,6 @@ void main()
     vec3 specular = light.specular * (spec * material.specular);  
         
     vec3 result = ambient + diffuse + specular;
+    result += ClusteredLighting(FragPos, norm, viewDir, texture(material.diffuse, TexCoords).rgb, material.specular, material.shininess);
     FragColor = vec4(result, 1.0);
 } 
\ No newline at end of file